@@ -83,50 +83,64 @@
 // 		CO_FREQ, CU_FREQ, and SERVICE_FREQ
 #define T0_FREQ					200
 
-// Manually calculate and enter the following values. They 
-// must be integers. Later conditional expressions will 
-// fail in the preprocessor if any non-integer values are 
-// present in the computation, even if the resultant 
-// evaluation turns out to be an integer.
+// The periods, in T0 ticks, are computed with integer
+// arithmetic, and the build fails below unless each
+// frequency divides T0_FREQ exactly.
 //
-#define CO_PERIOD				4			// (T0_FREQ / CO_FREQ)
-#define CU_PERIOD				1			// (T0_FREQ / CU_FREQ)
-#define SERVICE_PERIOD			2			// (T0_FREQ / SERVICE_FREQ)
+#define CO_PERIOD				(T0_FREQ / CO_FREQ)			// 4
+#define CU_PERIOD				(T0_FREQ / CU_FREQ)			// 1
+#define SERVICE_PERIOD			(T0_FREQ / SERVICE_FREQ)	// 2
 
 
 ///////////////////////////////////////////////////////
 // Several performance optimizations are possible if certain
 // values are integral factors of others and/or are
 // powers of 2. However, constructs that depend on these 
-// properties can otherwise break the code.
+// properties can otherwise break the code, so they are 
+// tested here rather than entered by hand.
 //
-// Preprocessor conditional expressions cannot contain 
-// non-integral values. Consequently, there is apparently 
-// no way to detect whether an expression *is* non-integer;
-// the preprocessor simply dies with the error
-// "Illegal constant expression."
-//
-// Therefore, the logic intended by the indicated 
-// expressions below must be explicitly programmed 
-// case-by-case, based on manually-computed values 
-// derived from SYS_FREQ, SERVICE_FREQ, CO_FREQ, and CU_FREQ.
-//
-///////////////////////////////////////////////////////
-// Set these values to 1 (true) if the pseudo-coded 
-// conditions are met, othewise, 0 (false):
-//
-/*
-#define T0_DIVIDES_SYS						isNonZeroInteger(SYS_FREQ/T0_FREQ)
+#define isPowerOfTwo(x)						(((x) & ((x) - 1)) == 0)
+
+#define T0_DIVIDES_SYS						(SYS_FREQ % T0_FREQ == 0)
 #define T0_FREQ_IPOT						isPowerOfTwo(T0_FREQ)
 #define CO_PERIOD_IPOT						isPowerOfTwo(CO_PERIOD)
 #define CU_PERIOD_IPOT						isPowerOfTwo(CU_PERIOD)
 #define SERVICE_PERIOD_IPOT					isPowerOfTwo(SERVICE_PERIOD)
-*/
-#define T0_DIVIDES_SYS						1
-#define T0_FREQ_IPOT						0
-#define CO_PERIOD_IPOT						1
-#define CU_PERIOD_IPOT						1
-#define SERVICE_PERIOD_IPOT					1
+
+#if !T0_DIVIDES_SYS
+#error "T0_FREQ must divide SYS_FREQ"
+#endif
+#if CO_PERIOD * CO_FREQ != T0_FREQ
+#error "CO_FREQ must divide T0_FREQ"
+#endif
+#if CU_PERIOD * CU_FREQ != T0_FREQ
+#error "CU_FREQ must divide T0_FREQ"
+#endif
+#if SERVICE_PERIOD * SERVICE_FREQ != T0_FREQ
+#error "SERVICE_FREQ must divide T0_FREQ"
+#endif
+
+///////////////////////////////////////////////////////
+// isr_timer0() schedule
+//
+// isr_timer0() looks up each tick's work in a table of
+// T0_SCHEDULE_TICKS entries, instead of testing T0Ticks
+// against each period. The length is the least common 
+// multiple of the periods, and is limited to 
+// T0_SCHEDULE_MAX entries (0 here if it would be longer).
+//
+#define T0_SCHEDULE_MAX			16
+#define T0_COVERS(n)			((n) % CO_PERIOD == 0 && (n) % CU_PERIOD == 0 && (n) % SERVICE_PERIOD == 0)
+#define T0_SCHEDULE_TICKS		(T0_COVERS(1) ? 1 : T0_COVERS(2) ? 2 : T0_COVERS(3) ? 3 : \
+								 T0_COVERS(4) ? 4 : T0_COVERS(5) ? 5 : T0_COVERS(6) ? 6 : \
+								 T0_COVERS(7) ? 7 : T0_COVERS(8) ? 8 : T0_COVERS(9) ? 9 : \
+								 T0_COVERS(10) ? 10 : T0_COVERS(11) ? 11 : T0_COVERS(12) ? 12 : \
+								 T0_COVERS(13) ? 13 : T0_COVERS(14) ? 14 : T0_COVERS(15) ? 15 : \
+								 T0_COVERS(16) ? 16 : 0)	// 4
+
+#if T0_SCHEDULE_TICKS == 0
+#error "the least common multiple of the T0 periods must not exceed T0_SCHEDULE_MAX"
+#endif
 
 
 ///////////////////////////////////////////////////////
@@ -138,11 +152,21 @@
 //
 // TO_PRESCALE must a power of 2 in the range [1..128]
 //
-// Manually calculate and enter the following value.
-// 
-// #define T0_PRESCALE = 	(LOWEST POWER OF 2 >= SYS_FREQ / TIMER_MAX / T0_FREQ)
+// T0_PRESCALE is the lowest power of 2 that brings the
+// T0 reload value (SYS_FREQ / T0_PRESCALE / T0_FREQ) 
+// within TIMER_MAX.
 //
-#define T0_PRESCALE				1		// >= (5529600 / 65535 / 200) ~= 0.42
+#define T0_FITS(p)				(SYS_FREQ / (p) / T0_FREQ <= TIMER_MAX)
+#define T0_PRESCALE				(T0_FITS(1) ? 1 : T0_FITS(2) ? 2 : T0_FITS(4) ? 4 : \
+								 T0_FITS(8) ? 8 : T0_FITS(16) ? 16 : T0_FITS(32) ? 32 : \
+								 T0_FITS(64) ? 64 : 128)	// 1 (5529600 / 65535 / 200 ~= 0.42)
+
+#if !T0_FITS(T0_PRESCALE)
+#error "T0_FREQ is too low for Timer 0"
+#endif
+#if (SYS_FREQ / T0_PRESCALE) % T0_FREQ != 0
+#error "T0_FREQ must divide SYS_FREQ / T0_PRESCALE"
+#endif
 
 
 ///////////////////////////////////////////////////////
@@ -181,13 +205,56 @@
 // UART/RS232/RX/TX/serial communications speed
 #define SYS_BAUD				BAUD_115200
 
+// The 'b' command can raise the speed at run time, to a 
+// rate that SYS_FREQ / 16 divides evenly. The new rate is
+// kept only if a valid command arrives within BAUD_TRIAL
+// seconds; otherwise it falls back to 115200.
+#define BAUD_TRIAL				2
+
+///////////////////////////////////////////////////////
+// Receive-interrupt command parser
+// Define _RX_PARSER to have isr_rx parse each command as
+// its characters arrive, into a queue of RX_QUEUE parsed
+// commands (5 bytes each), instead of the main loop 
+// parsing whole lines from uart.c's receive buffer. 
+// do_commands() then only dispatches, so a command costs
+// the main loop a fixed, small time, and it can be carried
+// out as soon as its terminator (CR or LF) arrives.
+// isr_rx takes the UART0 receive vector, so uart.c must 
+// leave out its own receive ISR (common_controller's 
+// uart.c doesn't, yet); its receive buffer goes unused.
+//#define _RX_PARSER
+#define RX_QUEUE				7
+
 ///////////////////////////////////////////////////////
 // serial data received and transmission buffers
 // NOTE: buffer sizes must be a power of 2
 // TXB_SIZE can be set to 0 to disable transmit buffering in order
-// to conserve EDATA space at a cost in performance.
+// to conserve EDATA space at a cost in performance. 64 holds
+// any one report; longer output (a trace dump) waits for room.
+#ifdef _RX_PARSER
+#define RXB_SIZE				4		// unused
+#else
 #define RXB_SIZE				32		
-#define TXB_SIZE				128
+#endif
+#define TXB_SIZE				64
+
+// Define _RX_FLOW_CONTROL (with _RX_PARSER) to drive -RTS
+// (PB3) high while RX_RTS_DEPTH or more commands are 
+// queued, so a host with CTS flow control holds off 
+// sending until the main loop has taken them. The rest
+// of the queue is left for characters already on their
+// way (a USB serial adapter may send several after -RTS
+// rises). Lost commands are still counted ('o') and 
+// reported in ERROR_BUF_OVFL. PB3 is a no connect on 
+// boards without the -RTS line.
+//#define _RX_FLOW_CONTROL
+#define RX_RTS_DEPTH			4
+
+// Define _REPLY_SEQ to end every reply with '#' and a 
+// reply sequence number, so a host pipelining commands can
+// tell a lost reply (see reply_end() in irq.c).
+//#define _REPLY_SEQ
 
 ///////////////////////////////////////////////////////
 // Uncomment these #define's to use optional uart.c
@@ -214,20 +281,86 @@
 #define ADC_CTL0_INIT			(ADC_CONT | ADC_CEN)	// continuous mode
 //#undef ADC_CTL0_INIT										// one-shot mode
 
-// Consecutive readings are considered "significantly different" 
-// if their adc counts differ by more than this:
-#define ADC_DELTA_LIMIT			1
+// Each analog input value is the average of a block of 
+// 2^ADC_OVERSAMPLE_BITS consecutive readings (max 4), 
+// retaining ADC_FRACTION_BITS (<= ADC_OVERSAMPLE_BITS)
+// fractional bits, i.e., Ain is in units of 
+// 1/2^ADC_FRACTION_BITS adc counts.
+#define ADC_OVERSAMPLE_BITS		3
+#define ADC_FRACTION_BITS		1
+
+
+///////////////////////////////////////////////////////
+// Servo current trace
+// Milliamps is recorded from the start of every move as 
+// 8-bit deltas, into TRACE_SIZE bytes: one sample every 
+// TRACE_PRESCALE controller updates through the inrush
+// (SKIP_INRUSH), then every TRACE_PRESCALE * TRACE_DECIMATE.
+// A change too large for a delta takes 3 bytes. With the
+// defaults (at CU_FREQ 200), that is 20 samples 10 ms apart,
+// then 80 ms apart, about 3.7 s of each move in all.
+// TRACE_SIZE must be <= 255. Set it to 0 to disable the
+// trace and conserve EDATA space.
+#define TRACE_SIZE				64
+#define TRACE_PRESCALE			2
+#define TRACE_DECIMATE			8
+
+///////////////////////////////////////////////////////
+// Per-channel settings
+// Comment out to drop the 64-channel settings table
+// (6 bytes per channel, 384 in all) and conserve EDATA space.
+// With the table, EDATA is nearly full: "make -C sim memory"
+// checks the estimate, and there is no room for a peak 
+// current per channel (only the most recent stop's, 'e').
+#define _CHANNEL_TABLE
+
+///////////////////////////////////////////////////////
+// Move program
+// The number of steps (7 bytes each) in the on-board move
+// program. Set it to 0 to disable the move program and
+// conserve EDATA space.
+#define PROGRAM_STEPS			4
+
+///////////////////////////////////////////////////////
+// ISR timing probes
+// Define _ISR_PROBES to keep latency and jitter statistics
+// for isr_timer0, the control pulse width, and isr_adc, 
+// reported by "wl". They take about 90 bytes of EDATA and
+// a few microseconds per interrupt.
+//#define _ISR_PROBES
+
+///////////////////////////////////////////////////////
+// Main loop stage profile
+// Define _STAGE_PROFILE to count the calls and time (in 
+// T0 clocks) spent in the main loop's stages, reported
+// by "wp". About 55 bytes of EDATA. In the host 
+// simulator, T0 clocks are estimated from host time
+// (see sim/sim.h).
+//#define _STAGE_PROFILE
 
-// The input is considered stable if this many consecutive
-// readings aren't "significantly different"
-#define ADC_STABLE				3
+///////////////////////////////////////////////////////
+// Hardware-timed control pulse
+// Define _T1OUT_PULSE to have Timer 1 end each control 
+// pulse on its T1OUT pin, in one-shot mode, instead of 
+// isr_timer1 ending it on PA3. The pulse width then 
+// doesn't depend on interrupt latency, and isr_timer1 
+// isn't used. It needs a board with SERVO_CP on T1OUT 
+// (PA7) and ADDR5 on PA3; see gpio.h.
+//#define _T1OUT_PULSE
 
 
 ///////////////////////////////////////////////////////
 // Implementation-specific IRQ priorities
 #define EI_T0()					IRQ0_PRIORITY_HIGH(IRQ_T0);
+#ifdef _T1OUT_PULSE
+#define EI_T1()					// Timer 1 ends the pulse without an interrupt
+#else
 #define EI_T1()					IRQ0_PRIORITY_NOMINAL(IRQ_T1);
+#endif
 #define EI_RX()					IRQ0_PRIORITY_LOW(IRQ_U0R)
 #define EI_TX()					IRQ0_PRIORITY_LOW(IRQ_U0T)
 #define EI_ADC()				IRQ0_PRIORITY_LOW(IRQ_ADC);
 
+// Limit switches: PA1 (-LIMIT0) and PA0 (-LIMIT1) falling edges, nominal priority
+#define EI_LIMITS()				{ IRQES &= ~0x03; IRQ1ENH |= 0x03; IRQ1ENL &= ~0x03; }
+
@@ -22,6 +22,10 @@
 
 #define ERROR_BOTH_LIMITS	1024	// both limit switches activated?
 #define ERROR_LOW_POWER		2048	// low Servo Power Supply Voltage
+#define ERROR_FRAME			4096	// multi-servo frame full, or pulse too long for a slot
+#define ERROR_STALL			8192	// StopOnStall out of range
+#define ERROR_PROGRAM		16384	// move program full, or a WaitForStop step timed out
+#define ERROR_TIMING		32768	// an ISR overran CO_MAX_RESERVE (_ISR_PROBES only)
 
 
 extern volatile uint16_t Error;
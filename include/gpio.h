@@ -42,11 +42,11 @@
 
 ///////////////////////////////////////////////////////
 // Port A
-// PA7 = OUT: ADDR5
+// PA7 = OUT: ADDR5 (T1OUT / SERVO_CP, Alt. function, if _T1OUT_PULSE)
 // PA6 = OUT: ADDR4
 // PA5 = OUT: TXD0 (Alt. function)
 // PA4 =  IN: RXD0 (Alt. function)
-// PA3 = OUT: SIGNAL1 / SERVO_CP
+// PA3 = OUT: SIGNAL1 / SERVO_CP (ADDR5 if _T1OUT_PULSE)
 // PA2 = OUT: ADDR_EN
 // PA1 =  IN: SIGNAL2 / -LIMIT0 / SCOM-RX/TXD 
 // PA0 =  IN: SIGNAL3 / -LIMIT1 / SCOM-TX/RXD
@@ -60,20 +60,45 @@
 // PAAF		= 00110000		// alternate functions
 // PAOUT	= 00000000		// defaults
 #define PA_DD					0x13
+#ifdef _T1OUT_PULSE
+#define PA_OC					0x80
+#define PA_AF					0xB0
+#else
 #define PA_OC					0x08
 #define PA_AF					0x30
+#endif
 #define PA_OUT					0x00
 
 #define ADDR_EN					0x04
 #define ADDR_EN_low()			mask_clr(PAOUT, ADDR_EN)
 #define ADDR_EN_high()			mask_set(PAOUT, ADDR_EN)
 
+#ifdef _T1OUT_PULSE
+// SERVO_CP is T1OUT (PA7), open drain like PA3 is 
+// otherwise. While Timer 1 is stopped, T1OUT follows 
+// T1CTL1's TPOL bit.
+#define T1_TEN					0x80
+#define T1_TPOL					0x40
+#define SERVO_CP_low()			(T1CTL1 = 0)
+#define SERVO_CP_high()			(T1CTL1 = T1_TPOL)
+#define SERVO_CP_is_low()		((T1CTL1 & T1_TPOL) == 0)
+#define SERVO_CP_is_high()		((T1CTL1 & T1_TPOL) == T1_TPOL)
+
+// ADDR5 is PA3, ADDR4 is PA6 (ADDR3..ADDR0 are on Port C)
+#define ADDR_PA_MASK			0x48
+#define ADDR_PA(ch)				((((ch) & 0x10) << 2) | (((ch) & 0x20) >> 2))
+#else
 #define SERVO_CP				0x08
 #define SERVO_CP_low()			mask_clr(PAOUT, SERVO_CP)
 #define SERVO_CP_high()			mask_set(PAOUT, SERVO_CP)
 #define SERVO_CP_is_low()		((SERVO_CP & PAOUT) == 0)
 #define SERVO_CP_is_high()		((SERVO_CP & PAOUT) == SERVO_CP)
 
+// ADDR5..ADDR4 are PA7..PA6 (ADDR3..ADDR0 are on Port C)
+#define ADDR_PA_MASK			0xC0
+#define ADDR_PA(ch)				(((ch) & 0x30) << 2)
+#endif
+
 #define LIMIT0					0x02
 #define LIMIT0_detected()		!(PAIN & LIMIT0)
 
@@ -86,7 +111,7 @@
 // PB6 = N/A
 // PB5 = N/A
 // PB4 = N/A
-// PB3 = OUT:  no connect
+// PB3 = OUT:  -RTS (if _RX_FLOW_CONTROL; otherwise no connect)
 // PB2 =  IN:  ANA2 (Alt. function) = SERVO_V
 // PB1 =  IN:  ANA1 (Alt. function) = SERVO_I
 // PB0 = OUT:  no connect
@@ -102,6 +127,16 @@
 #define PB_AF					0x06
 #define PB_OUT					0x00
 
+// -RTS is low (asserted) when the host may send
+#define RX_RTS					0x08
+#ifdef _RX_FLOW_CONTROL
+#define RX_ready()				mask_clr(PBOUT, RX_RTS)
+#define RX_busy()				mask_set(PBOUT, RX_RTS)
+#else
+#define RX_ready()
+#define RX_busy()
+#endif
+
 
 ///////////////////////////////////////////////////////
 // Port C
@@ -125,6 +160,10 @@
 #define PC_AF					0x00
 #define PC_OUT					0x00
 
+// ADDR3..ADDR0 are PC3..PC0 (ADDR5..ADDR4 are on Port A)
+#define ADDR_PC_MASK			0x0F
+#define ADDR_PC(ch)				((ch) & 0x0F)
+
 ///////////////////////////////////////////////////////
 // prototypes
 //
@@ -0,0 +1,17 @@
+///////////////////////////////////////////////////////
+// adc.h
+//
+// host simulation stand-in for common_controller's adc.h
+
+#pragma once // Include this file only once
+
+#include "c99types.h"
+
+#define ADCD_VALID(x)			((x) >= 0)
+#define ADC_OUTOFRANGE			-1
+
+extern volatile uint8_t AdcdSettling;	// readings to discard after a channel change
+
+void sim_adc_select(uint8_t ch);
+#define ADC_SELECT(ch)			sim_adc_select(ch)
+void adc_reset(void);
@@ -0,0 +1,12 @@
+///////////////////////////////////////////////////////
+// c99types.h
+//
+// host simulation stand-in for common_controller's c99types.h
+
+#pragma once // Include this file only once
+
+#include <stdint.h>
+
+typedef uint8_t BOOL;
+#define TRUE					1
+#define FALSE					0
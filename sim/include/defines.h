@@ -0,0 +1,7 @@
+///////////////////////////////////////////////////////
+// defines.h
+//
+// host simulation stand-in for ZDS II's <defines.h>
+
+#pragma once // Include this file only once
+
@@ -0,0 +1,60 @@
+///////////////////////////////////////////////////////
+// ez8.h
+//
+// host simulation stand-in for ZDS II's <ez8.h>
+
+#pragma once // Include this file only once
+
+#include <stdint.h>
+
+// ZDS II keywords
+#define rom						const
+#define interrupt
+#define reentrant
+#ifndef far
+#define far										// EDATA; the host has one address space
+#endif
+
+// The 8-bit registers are reached through sim_reg(), so the 
+// simulator can record the order in which they're accessed.
+enum
+{
+	SIM_PAIN, SIM_PAOUT, SIM_PBOUT, SIM_PCIN, SIM_PCOUT,
+	SIM_IRQES, SIM_IRQ1ENH, SIM_IRQ1ENL,
+	SIM_T0H, SIM_T0L, SIM_T1H, SIM_T1L, SIM_T1RH, SIM_T1RL, SIM_T1CTL0, SIM_T1CTL1,
+	SIM_U0BRH, SIM_U0BRL, SIM_U0STAT0, SIM_U0RXD,
+	SIM_REGS
+};
+volatile uint8_t *sim_reg(uint8_t r);
+
+#define PAIN					(*sim_reg(SIM_PAIN))
+#define PAOUT					(*sim_reg(SIM_PAOUT))
+#define PBOUT					(*sim_reg(SIM_PBOUT))
+#define PCIN					(*sim_reg(SIM_PCIN))
+#define PCOUT					(*sim_reg(SIM_PCOUT))
+#define IRQES					(*sim_reg(SIM_IRQES))
+#define IRQ1ENH					(*sim_reg(SIM_IRQ1ENH))
+#define IRQ1ENL					(*sim_reg(SIM_IRQ1ENL))
+#define T0H						(*sim_reg(SIM_T0H))
+#define T0L						(*sim_reg(SIM_T0L))
+#define T1H						(*sim_reg(SIM_T1H))
+#define T1L						(*sim_reg(SIM_T1L))
+#define T1RH					(*sim_reg(SIM_T1RH))
+#define T1RL					(*sim_reg(SIM_T1RL))
+#define T1CTL0					(*sim_reg(SIM_T1CTL0))
+#define T1CTL1					(*sim_reg(SIM_T1CTL1))
+#define U0BRH					(*sim_reg(SIM_U0BRH))
+#define U0BRL					(*sim_reg(SIM_U0BRL))
+#define U0STAT0					(*sim_reg(SIM_U0STAT0))
+#define U0RXD					(*sim_reg(SIM_U0RXD))
+
+extern volatile int ADCD;
+
+// There is only one thread of execution; interrupts are
+// called by the simulator, between main loop passes.
+#define DI()
+#define EI()
+
+enum { TIMER0, TIMER1, ADC, P0AD, P1AD, UART0_RX, VECTORS };
+extern void (*sim_vector[VECTORS])(void);
+#define SET_VECTOR(v, isr)		(sim_vector[v] = isr)
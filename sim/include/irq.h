@@ -0,0 +1,16 @@
+///////////////////////////////////////////////////////
+// irq.h
+//
+// host simulation stand-in for common_controller's irq.h
+
+#pragma once // Include this file only once
+
+#define IRQ_T0					0
+#define IRQ_T1					1
+#define IRQ_U0R					2
+#define IRQ_U0T					3
+#define IRQ_ADC					4
+
+#define IRQ0_PRIORITY_HIGH(irq)
+#define IRQ0_PRIORITY_NOMINAL(irq)
+#define IRQ0_PRIORITY_LOW(irq)
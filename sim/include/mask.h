@@ -0,0 +1,9 @@
+///////////////////////////////////////////////////////
+// mask.h
+//
+// host simulation stand-in for common_controller's mask.h
+
+#pragma once // Include this file only once
+
+#define mask_set(a, m)			((a) |= (m))
+#define mask_clr(a, m)			((a) &= ~(m))
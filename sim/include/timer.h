@@ -0,0 +1,18 @@
+///////////////////////////////////////////////////////
+// timer.h
+//
+// host simulation stand-in for common_controller's timer.h
+
+#pragma once // Include this file only once
+
+#include "c99types.h"
+
+#define T1_FREQ					(SYS_FREQ / T1_PRESCALE)
+#define T1_CLOCK_FREQ			T1_FREQ
+
+extern volatile uint16_t T0Ticks;
+
+void set_timer1_mark(uint16_t mark);
+void start_timer1(void);
+void stop_timer1(void);
+#define IRQ_CLEAR_T1()
@@ -0,0 +1,27 @@
+///////////////////////////////////////////////////////
+// uart.h
+//
+// host simulation stand-in for common_controller's uart.h
+
+#pragma once // Include this file only once
+
+#include "c99types.h"
+
+#define BAUD_115200				115200
+
+// Command input: GetInput() takes one queued line
+extern char Command[];
+extern int Narg;
+extern BOOL NargPresent;
+BOOL RxbEmpty(void);
+void GetInput(void);
+int TryInput(int min, int max, uint16_t error, int dflt, uint8_t decimals);
+
+// Output: written to SimOutput (and stdout if SimEcho)
+int putch(char c);
+void printi(int n, uint8_t width, char pad);
+void printdec(int n, uint8_t width, char pad, uint8_t decimals);
+void printSpace(void);
+void printromstr(rom char *s);
+void endLine(void);
+void endMessage(void);
@@ -0,0 +1,7 @@
+///////////////////////////////////////////////////////
+// z082a.h
+//
+// host simulation stand-in for common_controller's z082a.h
+
+#pragma once // Include this file only once
+
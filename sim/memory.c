@@ -0,0 +1,9 @@
+///////////////////////////////////////////////////////
+// memory.c
+//
+// irq.c with int as 16 bits, as under ZDS II, for the
+// RAM estimate in memory.sh. Not linked.
+
+#include <stdint.h>
+#define int short
+#include "irq.c"
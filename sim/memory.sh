@@ -0,0 +1,39 @@
+#!/bin/sh
+# Usage: memory.sh OBJECT SOURCE RXB_SIZE TXB_SIZE
+#
+# Estimates the RAM that SOURCE's globals take on the eZ8,
+# from OBJECT: SOURCE built for the host with int as short,
+# so every variable is at least as large as under ZDS II
+# (pointers and struct padding only make it larger). Globals
+# declared far go to EDATA (100-3FF), rom ones to flash, and
+# the rest, as the small model places them, to RDATA
+# (040-0FF). Fails if either is over its share:
+#
+#	RDATA	NEAR_BUDGET of the 192 bytes; the rest is for the
+#			stack, the compiler's frames, and common_controller
+#	EDATA	768 bytes less the UART buffers and FAR_RESERVE
+#			for common_controller's other far data
+#
+# Flash use can't be estimated on the host; only the ZDS II
+# map file shows it.
+
+NEAR_BUDGET=96
+FAR_RESERVE=32
+
+obj=$1 src=$2 rxb=$3 txb=$4
+far_budget=$((768 - rxb - txb - FAR_RESERVE))
+
+sed 's/\r$//' "$src" | sed -n -E 's/^(volatile )?(far|rom) [A-Za-z_0-9]+ \**([A-Za-z_0-9]+).*/\2 \3/p' |
+awk -v nm="nm -S -t d $obj" -v near_budget=$NEAR_BUDGET -v far_budget=$far_budget '
+	{ kind[$2] = $1 }
+	END {
+		while ((nm | getline) > 0)
+		{
+			if ($3 !~ /^[bBdD]$/) continue
+			name = $4; sub(/\..*/, "", name)	# function statics
+			if (kind[name] == "rom") continue
+			if (kind[name] == "far") far += $2; else near += $2
+		}
+		printf "RDATA %4d of %4d bytes\nEDATA %4d of %4d bytes\n", near, near_budget, far, far_budget
+		exit near > near_budget || far > far_budget
+	}'
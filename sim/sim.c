@@ -0,0 +1,427 @@
+///////////////////////////////////////////////////////
+// sim.c
+//
+// Hardware model for the host simulation: registers, 
+// interrupt vectors, Timer 1, the ADC and the UART, as seen
+// through common_controller's interface.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "sim.h"
+#include "timer.h"
+#include "adc.h"
+#include "uart.h"
+#include "mask.h"
+
+// from irq.c
+void init_irq(void);
+void update_controller(void);
+void do_commands(void);
+
+volatile uint16_t Error;
+
+volatile uint8_t SimReg[SIM_REGS];
+volatile int ADCD;
+void (*sim_vector[VECTORS])(void);
+
+SIM_ACCESS SimLog[SIM_LOG_SIZE];
+uint16_t SimLogLength;
+BOOL SimLogging;
+
+int SimAdc[8];
+static uint8_t AdcChannel;
+volatile uint8_t AdcdSettling;
+
+double SimClocksPerNs;
+static struct timespec T0Reload;		// host time of the last T0 reload
+static double LatchNs;					// host time to read the clock
+
+uint16_t SimT1Mark;
+BOOL SimT1Running;
+uint16_t SimPulseWidth;
+uint32_t SimPulses;
+
+char SimOutput[SIM_OUTPUT_SIZE];
+uint16_t SimOutputLength;
+BOOL SimEcho;
+
+#define RX_LINES				16
+#define RX_LINE_SIZE			32
+static char RxLine[RX_LINES][RX_LINE_SIZE];
+static uint8_t RxHead, RxTail;
+
+#ifdef _RX_PARSER
+#include "config.h"						// RX_QUEUE
+extern volatile uint8_t RxQueueFill, RxQueueTail;
+
+// Characters for isr_rx, sent by sim_step()
+#define RX_CHARS				40000	// a second at 345600 baud
+static char RxChars[RX_CHARS];
+static uint16_t RxCharsHead, RxCharsTail;
+uint8_t SimRxPerTick;
+BOOL SimMainBusy;
+BOOL SimIgnoreRts;
+BOOL SimRxCorrupt;
+#endif
+
+char Command[8];
+int Narg;
+BOOL NargPresent;
+static char Arg[RX_LINE_SIZE];			// the argument text, for TryInput()
+
+///////////////////////////////////////////////////////
+// registers
+
+static double since(const struct timespec *t)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) * 1e9 + (now.tv_nsec - t->tv_nsec);
+}
+
+// T0's count, from the host time since sim_step() reloaded
+// it, less the time reading the clock takes; reading T0H
+// latches T0L, as on the eZ8
+static void t0_latch()
+{
+	double clocks = 1 + (since(&T0Reload) - LatchNs) * SimClocksPerNs;
+
+	if (clocks < 1) clocks = 1;
+	if (clocks > 0xFFFF) clocks = 0xFFFF;
+	SimReg[SIM_T0H] = (unsigned)clocks >> 8;
+	SimReg[SIM_T0L] = (unsigned)clocks;
+}
+
+volatile uint8_t *sim_reg(uint8_t r)
+{
+	if (r == SIM_T0H)
+		t0_latch();
+	if (SimLogging && SimLogLength < SIM_LOG_SIZE)
+	{
+		SimLog[SimLogLength].reg = r;
+		memcpy(SimLog[SimLogLength].state, (const void *)SimReg, SIM_REGS);
+		++SimLogLength;
+	}
+	return &SimReg[r];
+}
+
+///////////////////////////////////////////////////////
+// timer 1
+void set_timer1_mark(uint16_t mark)
+{
+	SimT1Mark = mark;
+}
+
+void start_timer1()
+{
+	SimT1Running = TRUE;
+}
+
+void stop_timer1()
+{
+	SimT1Running = FALSE;
+}
+
+///////////////////////////////////////////////////////
+// adc
+void sim_adc_select(uint8_t ch)
+{
+	AdcChannel = ch & 7;
+}
+
+void adc_reset()
+{
+	AdcdSettling = SIM_ADC_SETTLING;
+}
+
+///////////////////////////////////////////////////////
+// uart input
+#ifdef _RX_PARSER
+// The CRC code a host sends after the message, per the
+// protocol notes' txByte(): polynomial DAAE (reversed), 
+// preset FFFF, inverted
+uint16_t sim_crc(const char *message)
+{
+	uint16_t crc = 0xFFFF;
+	uint8_t bit;
+
+	for (; *message; ++message)
+		for (crc ^= (uint8_t)*message, bit = 0; bit < 8; ++bit)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xDAAE : crc >> 1;
+	return ~crc;
+}
+
+static void rx_char(char c)
+{
+	RxChars[RxCharsHead] = c;
+	RxCharsHead = (RxCharsHead + 1) % RX_CHARS;
+}
+#endif
+
+// With _RX_PARSER, the line is sent as a message: its 
+// characters, the CRC code (low byte first; spoiled if 
+// SimRxCorrupt), and ETX, queued for sim_step() to pass 
+// to isr_rx.
+void sim_send(const char *line)
+{
+	#ifdef _RX_PARSER
+	uint16_t crc = sim_crc(line) ^ (SimRxCorrupt ? 0x0100 : 0);
+
+	while (*line)
+		rx_char(*line++);
+	rx_char(crc);
+	rx_char(crc >> 8);
+	rx_char(0x03);
+	#else
+	strncpy(RxLine[RxHead], line, RX_LINE_SIZE - 1);
+	RxHead = (RxHead + 1) % RX_LINES;
+	#endif
+}
+
+#ifdef _RX_PARSER
+uint16_t sim_rx_pending()
+{
+	return (RxCharsHead + RX_CHARS - RxCharsTail) % RX_CHARS;
+}
+#endif
+
+BOOL RxbEmpty()
+{
+	return RxHead == RxTail;
+}
+
+// Split the line into the command letters and an argument,
+// as the firmware's command parser does.
+void GetInput()
+{
+	const char *s = RxLine[RxTail];
+	uint8_t i = 0;
+
+	if (RxbEmpty())
+	{
+		Command[0] = '\0';
+		return;
+	}
+	RxTail = (RxTail + 1) % RX_LINES;
+	while (isalpha((unsigned char)*s) && i < sizeof(Command) - 1)
+		Command[i++] = tolower((unsigned char)*s++);
+	Command[i] = '\0';
+	while (*s == ' ')
+		++s;
+	strcpy(Arg, s);
+	NargPresent = isdigit((unsigned char)*s) || ((*s == '-' || *s == '.') && s[1]);
+	Narg = NargPresent ? atoi(s) : 0;
+}
+
+// The argument scaled by 10^decimals, or dflt if absent. 
+// Sets error if the argument is out of [min..max].
+int TryInput(int min, int max, uint16_t error, int dflt, uint8_t decimals)
+{
+	const char *s = Arg;
+	BOOL negative = FALSE;
+	long n = 0;
+
+	mask_clr(Error, error);
+	if (!NargPresent)
+		return dflt;
+	if (*s == '-')
+	{
+		negative = TRUE;
+		++s;
+	}
+	while (isdigit((unsigned char)*s))
+		n = n * 10 + *s++ - '0';
+	if (*s == '.')
+		++s;
+	for (; decimals; --decimals)
+		n = n * 10 + (isdigit((unsigned char)*s) ? *s++ - '0' : 0);
+	if (negative)
+		n = -n;
+	if (n < min || n > max)
+	{
+		mask_set(Error, error);
+		return dflt;
+	}
+	return (int)n;
+}
+
+///////////////////////////////////////////////////////
+// uart output
+int putch(char c)
+{
+	if (SimOutputLength < SIM_OUTPUT_SIZE - 1)
+	{
+		SimOutput[SimOutputLength++] = c;
+		SimOutput[SimOutputLength] = '\0';
+	}
+	if (SimEcho)
+		putchar(c);
+	return c;
+}
+
+static void print_string(const char *s)
+{
+	while (*s)
+		putch(*s++);
+}
+
+void printi(int n, uint8_t width, char pad)
+{
+	char s[16];
+
+	if (pad == '0')
+		snprintf(s, sizeof(s), "%0*d", width, n);
+	else
+		snprintf(s, sizeof(s), "%*d", width, n);
+	print_string(s);
+}
+
+void printdec(int n, uint8_t width, char pad, uint8_t decimals)
+{
+	char s[16];
+	char *p = s + sizeof(s) - 1;
+	unsigned u = n < 0 ? -n : n;
+	uint8_t i;
+
+	*p = '\0';
+	for (i = 0; u || i <= decimals; ++i)
+	{
+		if (i == decimals && decimals)
+			*--p = '.';
+		*--p = '0' + u % 10;
+		u /= 10;
+	}
+	if (n < 0)
+		*--p = '-';
+	for (i = strlen(p); i < width; ++i)
+		putch(pad);
+	print_string(p);
+}
+
+void printSpace()
+{
+	putch(' ');
+}
+
+void printromstr(rom char *s)
+{
+	print_string(s);
+}
+
+void endLine()
+{
+	putch('\n');
+}
+
+// The firmware adds a CRC and ETX; a newline will do here.
+void endMessage()
+{
+	putch('\n');
+}
+
+void sim_clear_output()
+{
+	SimOutputLength = 0;
+	SimOutput[0] = '\0';
+}
+
+///////////////////////////////////////////////////////
+// stepping
+
+void sim_reset()
+{
+	int i;
+
+	memset((void *)SimReg, 0, sizeof(SimReg));
+	SimReg[SIM_PAIN] = 0xFF;				// inputs pulled up
+	SimReg[SIM_PCIN] = 0xFF;
+	SimReg[SIM_U0STAT0] = 0x06;				// TDRE, TXE: transmitter idle
+	SimReg[SIM_T0L] = 1;					// T0 count just after a reload
+	SimClocksPerNs = SIM_CLOCKS_PER_NS;
+	clock_gettime(CLOCK_MONOTONIC, &T0Reload);
+	for (i = 0; i < 1000; ++i)
+		since(&T0Reload);
+	LatchNs = since(&T0Reload) / 1001;
+	clock_gettime(CLOCK_MONOTONIC, &T0Reload);
+	SimT1Running = FALSE;
+	SimPulses = 0;
+	RxHead = RxTail = 0;
+	#ifdef _RX_PARSER
+	RxCharsHead = RxCharsTail = 0;
+	SimRxPerTick = 0;
+	SimMainBusy = FALSE;
+	SimIgnoreRts = FALSE;
+	SimRxCorrupt = FALSE;
+	#endif
+	sim_clear_output();
+	init_irq();
+}
+
+// One T0 tick: the ADC conversions completed during the 
+// tick, T0 itself, then Timer 1 if it was started, and a 
+// pass of the main loop. With _T1OUT_PULSE, Timer 1 is
+// started through T1CTL1 and ends the pulse without an
+// interrupt, after (reload - start) clocks. With 
+// _RX_PARSER, up to SimRxPerTick characters (0: all that 
+// are waiting) go to isr_rx first, while -RTS is low 
+// unless SimIgnoreRts, with a main loop pass whenever its
+// queue fills or -RTS rises, as the firmware's runs many
+// times a tick.
+// SimMainBusy holds off the main loop.
+void sim_step()
+{
+	uint8_t i;
+
+	#ifdef _RX_PARSER
+	for (i = 0; RxCharsTail != RxCharsHead && (!SimRxPerTick || i < SimRxPerTick); ++i)
+	{
+		if (!SimIgnoreRts && (SimReg[SIM_PBOUT] & SIM_RTS))
+			break;
+		SimReg[SIM_U0RXD] = RxChars[RxCharsTail];
+		RxCharsTail = (RxCharsTail + 1) % RX_CHARS;
+		sim_vector[UART0_RX]();
+		if (!SimMainBusy && ((RxQueueFill + 1) % RX_QUEUE == RxQueueTail || (SimReg[SIM_PBOUT] & SIM_RTS)))
+			do_commands();
+	}
+	#endif
+
+	for (i = 0; i < SIM_ADC_PER_TICK; ++i)
+	{
+		ADCD = SimAdc[AdcChannel] << 3;
+		if (sim_vector[ADC])
+			sim_vector[ADC]();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &T0Reload);
+	sim_vector[TIMER0]();
+	#ifdef _T1OUT_PULSE
+	if (SimReg[SIM_T1CTL1] & SIM_T1_TEN)	// one-shot on T1OUT: times out within the tick
+	{
+		SimPulseWidth = (SimReg[SIM_T1RH] << 8 | SimReg[SIM_T1RL]) - (SimReg[SIM_T1H] << 8 | SimReg[SIM_T1L]);
+		++SimPulses;
+		*sim_reg(SIM_T1CTL1) &= ~SIM_T1_TEN;	// logged, after the writes that started it
+	}
+	#endif
+	if (SimT1Running)						// one-shot: ends within the tick
+	{
+		SimT1Running = FALSE;
+		SimPulseWidth = SimT1Mark;
+		++SimPulses;
+		sim_vector[TIMER1]();
+	}
+	#ifdef _RX_PARSER
+	if (SimMainBusy)
+		return;
+	#endif
+	update_controller();
+	do_commands();
+}
+
+void sim_run(uint16_t ticks)
+{
+	while (ticks--)
+		sim_step();
+}
@@ -0,0 +1,70 @@
+///////////////////////////////////////////////////////
+// sim.h
+//
+// Host simulation of the servo controller: irq.c runs 
+// unchanged against the stand-in headers in include/, and 
+// sim_step() plays the part of the eZ8 hardware, one T0 
+// tick at a time.
+
+#pragma once // Include this file only once
+
+#include <ez8.h>
+#include "c99types.h"
+
+#define SIM_ADC_PER_TICK		5		// conversions per T0 tick, ~5.1k clocks each
+#define SIM_ADC_SETTLING		1		// readings discarded after adc_reset()
+#define SIM_CLOCKS_PER_NS		50		// eZ8 clocks per host ns; see SimClocksPerNs
+#define SIM_OUTPUT_SIZE			8192
+#define SIM_LOG_SIZE			256
+
+// T0 counts eZ8 clocks from the host time since the tick
+// began, times SimClocksPerNs: a rough ratio of the eZ8's 
+// speed to the host's, so the stage profile and ISR probes
+// give estimates that can be compared between builds on 
+// the same host, not times. It stops at 0xFFFF.
+extern double SimClocksPerNs;
+
+// ADC input, in counts, for each ANAx channel
+extern int SimAdc[8];
+
+// Timer 1: the last mark, and a count of the pulses it ended
+#define SIM_T1_TEN				0x80	// T1CTL1 enable
+extern uint16_t SimT1Mark;
+extern BOOL SimT1Running;
+extern uint16_t SimPulseWidth;			// T1 clocks
+extern uint32_t SimPulses;
+
+// Output written by the controller; echoed to stdout if SimEcho
+extern char SimOutput[SIM_OUTPUT_SIZE];
+extern uint16_t SimOutputLength;
+extern BOOL SimEcho;
+
+// Register access log: while SimLogging, each access through
+// sim_reg() records the register and the state of every
+// register just before the access. A write's value is seen 
+// in the next entry's state (or in SimReg, for the last).
+typedef struct
+{
+	uint8_t reg;
+	uint8_t state[SIM_REGS];
+} SIM_ACCESS;
+
+extern volatile uint8_t SimReg[SIM_REGS];
+extern SIM_ACCESS SimLog[SIM_LOG_SIZE];
+extern uint16_t SimLogLength;
+extern BOOL SimLogging;
+
+void sim_reset(void);
+void sim_send(const char *line);
+#ifdef _RX_PARSER
+#define SIM_RTS					0x08	// PBOUT -RTS: high holds off the host
+extern uint8_t SimRxPerTick;			// characters sent to isr_rx per tick; 0 = all waiting
+extern BOOL SimMainBusy;				// no main loop passes
+extern BOOL SimIgnoreRts;				// the host sends regardless of -RTS
+extern BOOL SimRxCorrupt;				// sim_send() spoils the CRC code
+uint16_t sim_rx_pending(void);			// characters not yet sent to isr_rx
+uint16_t sim_crc(const char *message);	// the CRC code sim_send() sends
+#endif
+void sim_step(void);
+void sim_run(uint16_t ticks);
+void sim_clear_output(void);
@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////
+// simulate.c
+//
+// Steps the servo controller through a script read from 
+// stdin, one item per line:
+//		+N				run N T0 ticks
+//		@C N			ADC channel C reads N counts
+//		#...			comment
+//		anything else	a command, as sent to the UART
+// The controller's output is written to stdout.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+int main(void)
+{
+	char line[64];
+	int ch, counts;
+
+	SimEcho = TRUE;
+	sim_reset();
+	while (fgets(line, sizeof(line), stdin))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '+')
+			sim_run(atoi(line + 1));
+		else if (sscanf(line, "@%d %d", &ch, &counts) == 2)
+			SimAdc[ch & 7] = counts;
+		else if (line[0] && line[0] != '#')
+		{
+			sim_send(line);
+			sim_step();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,76 @@
+///////////////////////////////////////////////////////
+// test_baud.c
+//
+// For each rate 'b' offers: the BRG value it sets, that 
+// SYS_FREQ / 16 divides into the rate exactly, and the
+// bytes the UART moves in a CU period and a Datalogging 
+// second, against the length of a report line. With 
+// _RX_PARSER, also the commands carried out in a second 
+// when the host sends them back to back at that rate (10
+// bits a character), and that none is lost.
+
+#include <stdio.h>
+#include <string.h>
+#include "irq.c"
+#include "sim.h"
+
+#define COMMAND					"p1500"
+#define MESSAGE					(sizeof(COMMAND) - 1 + 3)	// and the CRC code and ETX
+
+static int Failures;
+
+#define CHECK(c)	do { if (!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); ++Failures; } } while (0)
+
+static void check_rate(uint8_t i)
+{
+	long baud = BAUD_HUNDREDS[i] * 100L;
+	char command[8];
+	uint16_t report;
+
+	sim_reset();
+	SimAdc[2] = 3000;						// servo supply above V_MIN
+	sprintf(command, "b%d", BAUD_HUNDREDS[i]);
+	sim_send(command);
+	sim_step();
+	CHECK(BaudRate == i && U0BRH == 0 && U0BRL == BAUD_BRG[i]);
+	CHECK(SYS_FREQ % (16L * BAUD_BRG[i]) == 0 && SYS_FREQ / (16L * BAUD_BRG[i]) == baud);
+
+	sim_clear_output();
+	report_device();
+	report = SimOutputLength;				// '\n' standing in for the CRC and ETX
+	printf("%6ld baud  BRG %d  %4ld bytes per CU period, %5ld a second; report %u bytes", 
+		baud, BAUD_BRG[i], baud / 10 / CU_FREQ, baud / 10, report);
+	fflush(stdout);
+
+	#ifdef _RX_PARSER
+	{
+		long sent = baud / 10 / MESSAGE, ticks = 0, n;
+		long needed;						// ticks to send them all
+
+		SimRxPerTick = baud / 10 / T0_FREQ;
+		needed = (sent * MESSAGE + SimRxPerTick - 1) / SimRxPerTick;
+		RxOverruns = 0;
+		for (n = 0; n < sent; ++n)
+			sim_send(COMMAND);
+		while ((sim_rx_pending() || !RxbEmpty()) && ticks < 2 * T0_FREQ)
+		{
+			sim_step();
+			++ticks;
+		}
+		printf("; %ld commands in %ld ticks (%ld a second)", sent, ticks, sent * T0_FREQ / ticks);
+		CHECK(ticks <= needed + 1 && RxOverruns == 0);
+		CHECK(BaudRate == i && !BaudTrial);	// the commands kept the rate
+	}
+	#endif
+	printf("\n");
+}
+
+int main(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < BAUD_RATES; ++i)
+		check_rate(i);
+	printf("%s\n", Failures ? "FAILED" : "passed");
+	return Failures != 0;
+}
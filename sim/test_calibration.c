@@ -0,0 +1,132 @@
+///////////////////////////////////////////////////////
+// test_calibration.c
+//
+// Checks the fixed-point conversions against the float 
+// computations they replaced: calibrate() to within 1 mA or
+// mV over the full adc range, for each board's constants 
+// and for gains up to the documented limit (gain_q * Ain 
+// within 32 bits), and setCpw() to within 1 T1 clock over 
+// CPW_MIN..CPW_MAX. 
+//
+// Also reports the time per conversion, fixed vs. float. 
+// That's host timing only: the eZ8 has no floating point 
+// hardware, so there the difference is far larger.
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "irq.c"
+#include "sim.h"
+
+#define COUNTS					2048		// adc range, 0..2047
+#define AIN_MAX					(COUNTS << ADC_FRACTION_BITS)
+#define REPEAT					200
+
+typedef struct
+{
+	double gain;
+	double offset;
+} CAL;
+
+// SERVO_I and SERVO_V constants from the SERNO tables in irq.c,
+// plus the limit given in the comment there (gain < 128).
+// Results that don't fit in 16 bits aren't compared.
+static const CAL Cals[] =
+{
+	{ A1_GAIN, A1_OFFSET }, { A2_GAIN, A2_OFFSET },
+	{ 1.0000, 0.0 }, { 12.167, 12.0 }, { 7.634, 0.0 }, { 2.0639, 0.0 },
+	{ 1.1446, 88.0 }, { 2.0089, 205.6 }, { 4.7619, 1920.9 }, { 127.99, 0.0 }
+};
+#define CALS					(sizeof(Cals) / sizeof(Cals[0]))
+
+static int Failures;
+static volatile double Sink;
+
+// the float computation that calibrate() replaced
+static double calibrate_float(int ain, double gain, double offset)
+{
+	double v = gain * ((double)ain / (1 << ADC_FRACTION_BITS) - offset);
+	return v < 0 ? 0 : floor(v);
+}
+
+static double seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void check_calibrate()
+{
+	unsigned i;
+	int ain;
+
+	for (i = 0; i < CALS; ++i)
+	{
+		int32_t gain_q = CAL_SCALE(Cals[i].gain, CAL_Q);
+		int32_t bias_q = CAL_SCALE(Cals[i].gain * Cals[i].offset, CAL_SHIFT);
+		double worst = 0;
+
+		if ((int64_t)gain_q * (AIN_MAX - 1) > INT32_MAX)
+		{
+			printf("calibrate  gain %8.4f  gain_q * Ain overflows\n", Cals[i].gain);
+			++Failures;
+		}
+		for (ain = 0; ain < AIN_MAX; ++ain)
+		{
+			double v = calibrate_float(ain, Cals[i].gain, Cals[i].offset);
+			if (v <= UINT16_MAX && fabs(calibrate(ain, gain_q, bias_q) - v) > worst)
+				worst = fabs(calibrate(ain, gain_q, bias_q) - v);
+		}
+		printf("calibrate  gain %8.4f offset %7.1f  max error %.0f\n", 
+			Cals[i].gain, Cals[i].offset, worst);
+		if (worst > 1.0) ++Failures;
+	}
+}
+
+static void check_cpw()
+{
+	int cpw;
+	double worst = 0;
+
+	for (cpw = CPW_MIN; cpw <= CPW_MAX; ++cpw)
+	{
+		double error;
+		setCpw(cpw);
+		error = fabs(Co - floor(cpw * (T1_FREQ / 1000000.0)));
+		if (error > worst) worst = error;
+	}
+	printf("setCpw     %d..%d us  max error %.0f T1 clocks\n", CPW_MIN, CPW_MAX, worst);
+	if (worst > 1.0) ++Failures;
+}
+
+static void report_speed()
+{
+	int32_t gain_q = A2_GAIN_Q, bias_q = A2_BIAS_Q;
+	double t, fixed, floating;
+	int ain, r;
+
+	t = seconds();
+	for (r = 0; r < REPEAT; ++r)
+		for (ain = 0; ain < AIN_MAX; ++ain)
+			Sink = calibrate(ain + (Sink < 0), gain_q, bias_q);
+	fixed = (seconds() - t) / REPEAT / AIN_MAX;
+
+	t = seconds();
+	for (r = 0; r < REPEAT; ++r)
+		for (ain = 0; ain < AIN_MAX; ++ain)
+			Sink = (uint16_t)calibrate_float(ain + (Sink < 0), A2_GAIN, A2_OFFSET);
+	floating = (seconds() - t) / REPEAT / AIN_MAX;
+
+	printf("host time per conversion: fixed %.2f ns, float %.2f ns\n", 
+		fixed * 1e9, floating * 1e9);
+}
+
+int main(void)
+{
+	check_calibrate();
+	check_cpw();
+	report_speed();
+	printf("%s\n", Failures ? "FAILED" : "passed");
+	return Failures != 0;
+}
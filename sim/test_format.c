@@ -0,0 +1,134 @@
+///////////////////////////////////////////////////////
+// test_format.c
+//
+// Checks printudec() against the formatter it replaced:
+// the same text as printdec() (and so printi(), with no
+// decimals) for every 16-bit value, each width up to 7, 
+// 0 to 4 decimals, and both pads. The host's int is 32
+// bits, so printdec() covers 32768..65535 here too.
+//
+// Also reports the time per report_device() line, against
+// the same line from printdec(). The simulator's printi()
+// uses snprintf(), so printdec(), which divides by 10 for
+// each digit as uart.c does, stands in for both. That's 
+// host timing only: the eZ8 has no divide instruction, so 
+// there the difference is far larger; the divisions and
+// subtractions per line are counted too.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "irq.c"
+#include "sim.h"
+
+#define REPEAT					100000
+
+static int Failures;
+
+static double seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void check_printudec()
+{
+	static const char Pads[] = { ' ', '0' };
+	char expected[16];
+	long n;
+	uint8_t width, decimals, p;
+	long compared = 0;
+
+	for (n = 0; n <= UINT16_MAX; ++n)
+		for (decimals = 0; decimals <= 4; ++decimals)
+			for (width = 0; width <= 7; ++width)
+				for (p = 0; p < sizeof(Pads); ++p)
+				{
+					sim_clear_output();
+					printdec(n, width, Pads[p], decimals);
+					strcpy(expected, SimOutput);
+					sim_clear_output();
+					printudec(n, width, Pads[p], decimals);
+					++compared;
+					if (strcmp(SimOutput, expected) && Failures++ < 10)
+						printf("printudec(%ld, %d, '%c', %d): \"%s\", not \"%s\"\n",
+							n, width, Pads[p], decimals, SimOutput, expected);
+				}
+	printf("printudec  %ld cases compared with printdec\n", compared);
+}
+
+// report_device() as it was, before printudec()
+static void report_device_printdec()
+{
+	printdec(Channel, 3, ' ', 0); printSpace();
+	printdec(Cpw, 5, ' ', 0); printSpace();
+	printdec(CpEnabled, 1, ' ', 0); printSpace();
+	printdec(StopOnLimit0, 1, ' ', 0);
+	printdec(Limit0, 1, ' ', 0); printSpace();
+	printdec(StopOnLimit1, 1, ' ', 0);
+	printdec(Limit1, 1, ' ', 0); printSpace();
+	printdec(StopOnMilliamps, 4, ' ', 0); printSpace();
+	printdec(Milliamps, 4, ' ', 0); printSpace();
+	printdec(StopOnTimeout, 6, ' ', 2); printSpace();
+	printdec(Elapsed, 6, ' ', 2); printSpace();
+	printdec(Vps, 6, ' ', 3); printSpace();
+	printdec(Error, 5, ' ', 0);
+	endMessage();
+}
+
+static double time_report(void (*report)(void), char *line)
+{
+	double t;
+	int r;
+
+	t = seconds();
+	for (r = 0; r < REPEAT; ++r)
+	{
+		sim_clear_output();
+		report();
+	}
+	t = (seconds() - t) / REPEAT;
+	strcpy(line, SimOutput);
+	return t;
+}
+
+static void report_speed()
+{
+	char line[2][64];
+	double t[2];
+	const char *s;
+	int digits = 0, subtractions = 0;
+
+	sim_reset();
+	Channel = 12; Cpw = 1500; CpEnabled = TRUE; StopOnLimit0 = TRUE;
+	StopOnMilliamps = 800; Milliamps = 347; StopOnTimeout = 1000;
+	Elapsed = 437; Vps = 12034; Error = ERROR_NONE;
+
+	t[0] = time_report(report_device, line[0]);
+	t[1] = time_report(report_device_printdec, line[1]);
+	if (strcmp(line[0], line[1]))
+	{
+		printf("report_device \"%s\", not \"%s\"\n", line[0], line[1]);
+		++Failures;
+	}
+	// printdec() divides twice per digit; printudec() 
+	// subtracts each digit's value times
+	for (s = line[0]; *s; ++s)
+		if (*s >= '0' && *s <= '9')
+		{
+			++digits;
+			subtractions += *s - '0';
+		}
+	printf("host time per report: printudec %.1f ns, printdec %.1f ns\n", t[0] * 1e9, t[1] * 1e9);
+	printf("per report: printudec %d subtractions, printdec %d divisions\n", subtractions, 2 * digits);
+}
+
+int main(void)
+{
+	sim_reset();
+	check_printudec();
+	report_speed();
+	printf("%s\n", Failures ? "FAILED" : "passed");
+	return Failures != 0;
+}
@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////
+// test_pulse.c
+//
+// Checks the control pulse over the full CPW_MIN..CPW_MAX
+// range. Without _T1OUT_PULSE, the pulse isr_timer1 ends 
+// must be Co T1 clocks, within CO_MIN..CO_MAX. With it, 
+// start_pulse()'s register writes are checked as well:
+// Timer 1 must be loaded with a count of 0 and a reload
+// of Co before T1OUT rises, and started by the very next
+// write, then TPOL inverted so the pin drops at the timeout.
+// At both ends of the range, the width must also be within
+// one T1 clock of the commanded microseconds.
+
+#include <stdio.h>
+#include <math.h>
+#include "irq.c"
+#include "sim.h"
+
+static int Failures;
+
+#define CHECK(c, cpw)	do { if (!(c)) { printf("FAIL %s:%d: Cpw %d: %s\n", \
+							__FILE__, __LINE__, cpw, #c); ++Failures; return; } } while (0)
+
+#ifdef _T1OUT_PULSE
+#define T1_LOADS(r)		((r) == SIM_T1H || (r) == SIM_T1L || (r) == SIM_T1RH || (r) == SIM_T1RL)
+
+// the register's value after log entry k
+static uint8_t after(uint16_t k)
+{
+	return k + 1 < SimLogLength ? SimLog[k + 1].state[SimLog[k].reg] : SimReg[SimLog[k].reg];
+}
+
+static void check_pulse(int cpw)
+{
+	uint16_t k, rise = SimLogLength, loads = 0, rises = 0;
+	const uint8_t *s;
+
+	for (k = 0; k < SimLogLength; ++k)
+	{
+		uint8_t r = SimLog[k].reg;
+		if (T1_LOADS(r))
+		{
+			CHECK(rise == SimLogLength, cpw);	// loaded before the pulse starts
+			++loads;
+		}
+		if (r == SIM_T1CTL1 && !(SimLog[k].state[r] & T1_TPOL) && (after(k) & T1_TPOL))
+		{
+			rise = k;
+			++rises;
+		}
+	}
+	CHECK(rises == 1 && loads == 4, cpw);
+	CHECK(rise + 2 < SimLogLength, cpw);
+
+	s = SimLog[rise].state;
+	CHECK(!(s[SIM_T1CTL1] & T1_TEN), cpw);
+	CHECK((s[SIM_T1H] << 8 | s[SIM_T1L]) == 0, cpw);
+	CHECK((uint16_t)(s[SIM_T1RH] << 8 | s[SIM_T1RL]) == Co, cpw);
+	CHECK(SimLog[rise + 1].reg == SIM_T1CTL1 && after(rise + 1) == (T1_TEN | T1_TPOL | T1_ONE_SHOT), cpw);
+	CHECK(SimLog[rise + 2].reg == SIM_T1CTL1 && after(rise + 2) == (T1_TEN | T1_ONE_SHOT), cpw);
+	CHECK(SimPulses == 1, cpw);
+	CHECK(SimPulseWidth == Co, cpw);
+}
+#else
+static void check_pulse(int cpw)
+{
+	CHECK(SimPulses == 1, cpw);
+	CHECK(SimPulseWidth == Co, cpw);
+	CHECK(Co >= CO_MIN && Co <= CO_MAX, cpw);
+}
+#endif
+
+static void check_width(int cpw)
+{
+	setCpw(cpw);
+	sim_run(CO_PERIOD);
+	SimPulses = 0;
+	sim_run(CO_PERIOD);
+	CHECK(SimPulses == 1, cpw);
+	CHECK(fabs(SimPulseWidth - cpw * (T1_FREQ / 1000000.0)) < 1, cpw);
+}
+
+int main(void)
+{
+	int cpw;
+
+	sim_reset();
+	SimAdc[2] = 3000;						// servo supply above V_MIN
+	sim_send("g");
+	sim_run(CO_PERIOD);
+
+	for (cpw = CPW_MIN; cpw <= CPW_MAX && Failures < 10; ++cpw)
+	{
+		setCpw(cpw);
+		sim_run(CO_PERIOD);					// update_CO() takes it up
+		SimPulses = 0;
+		SimLogLength = 0;
+		SimLogging = TRUE;
+		sim_run(CO_PERIOD);
+		SimLogging = FALSE;
+		check_pulse(cpw);
+	}
+	check_width(CPW_MIN);
+	check_width(CPW_MAX);
+	printf("%d..%d us: %s\n", CPW_MIN, CPW_MAX, Failures ? "FAILED" : "passed");
+	return Failures != 0;
+}
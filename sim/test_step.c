@@ -0,0 +1,345 @@
+///////////////////////////////////////////////////////
+// test_step.c
+//
+// Smoke test for the host simulation: the controller 
+// starts, pulses at the CO rate, and answers commands.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "irq.c"
+#include "sim.h"
+
+static int Failures;
+
+// Send a message of commands and return the Error field of
+// the 'a' reply that ends it.
+static int ack(const char *commands)
+{
+	char line[32];
+	char *s;
+
+	sim_clear_output();
+	strcpy(line, commands);
+	for (s = strtok(line, ";"); s; s = strtok(NULL, ";"))
+		sim_send(s);
+	sim_send("a1");
+	sim_step();
+	s = strchr(SimOutput, 'A');
+	return s ? atoi(s + 7) : -1;
+}
+
+#define CHECK(c)	do { if (!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); ++Failures; } } while (0)
+
+int main(void)
+{
+	sim_reset();
+	SimAdc[2] = 3000;						// servo supply above V_MIN
+	sim_send("g");
+	sim_run(T0_FREQ);						// one second
+
+	CHECK(T0Ticks == T0_FREQ);
+	CHECK(SimPulses >= CO_FREQ - 1 && SimPulses <= CO_FREQ);
+	CHECK(SimPulseWidth == Co);
+	CHECK(!(Error & ERROR_LOW_POWER));
+
+	sim_clear_output();
+	sim_send("a7");
+	sim_step();
+	CHECK(SimOutput[0] == 'A');
+	CHECK(atoi(SimOutput + 1) == 7);
+
+	// a failed command is reported by the next 'a', only
+	CHECK(!(ack("p1500") & ERROR_COMMAND));
+	CHECK(ack("x;p1500") & ERROR_COMMAND);
+	CHECK(!(ack("p1500") & ERROR_COMMAND));
+
+	// every receive overrun is reported by 'a' (and, from 
+	// uart.c, counted here; isr_rx counts its own, below)
+#ifndef _RX_PARSER
+	RxOverruns = 0;
+	Error |= ERROR_BUF_OVFL;				// as uart.c does
+	sim_step();
+	Error |= ERROR_BUF_OVFL;
+	sim_step();
+	CHECK(RxOverruns == 2);
+#endif
+	Error |= ERROR_BUF_OVFL;
+	CHECK(ack("p1500") & ERROR_BUF_OVFL);
+	CHECK(!(ack("p1500") & ERROR_BUF_OVFL));
+
+	// each frame slot times out on its own; the last 't' 
+	// setting doesn't stop the whole frame
+	ack("n1;t0.8;fa;n2;t0.2;fa;fg");
+	sim_run(T0_FREQ * 3 / 10);
+	CHECK(CpEnabled);
+	sim_run(T0_FREQ);
+	CHECK(!CpEnabled);
+
+	// a level current stops on stall, but not a level zero
+	ack("fc;t0;j50;g");
+	SimAdc[1] = 600;						// ~530 mA, from the start
+	sim_run(T0_FREQ * 2);
+	CHECK(!CpEnabled && (StopReason & STOP_STALL));
+	SimAdc[1] = 0;
+	sim_run(T0_FREQ / 10);					// let Ain settle
+	ack("g");
+	sim_run(T0_FREQ * 2);
+	CHECK(CpEnabled);
+
+	// the baud rate changes only once the reply has been sent,
+	// and is kept only if a valid command follows
+	ack("s");
+	SimReg[SIM_U0STAT0] = 0;				// transmitting
+	ack("b1728");
+	sim_run(5);
+	CHECK(BaudRate == BAUD_FALLBACK);
+	SimReg[SIM_U0STAT0] = 0x06;
+	sim_step();
+	CHECK(BaudRate != BAUD_FALLBACK && BaudTrial);
+	sim_send("x");
+	sim_send("");
+	sim_step();
+	CHECK(BaudTrial);
+	sim_send("p1500");
+	sim_step();
+	CHECK(!BaudTrial && BaudRate != BAUD_FALLBACK);
+	ack("b1152");
+	sim_step();
+	CHECK(BaudRate == BAUD_FALLBACK);
+	ack("b3456");
+	sim_run(BAUD_TRIAL * T0_FREQ + 1);
+	CHECK(!BaudTrial && BaudRate == BAUD_FALLBACK);
+
+	// events report only the stops after "e1"
+	ack("e0;p1500;t0.05;g");
+	sim_run(T0_FREQ / 2);
+	CHECK(!CpEnabled);
+	sim_clear_output();
+	sim_send("e1");
+	sim_run(5);
+	CHECK(!strchr(SimOutput, 'E'));
+	ack("g");
+	sim_run(T0_FREQ / 2);
+	CHECK(strchr(SimOutput, 'E'));
+	ack("e0;t0");
+
+	// program steps leave the channel's own settings alone,
+	// and a WaitForStop step that times out halts the program
+	ack("qc;n4;p1300;t0.05;qa");
+	ack("p1400;qa1;p1600;qa");
+	ack("p1500;t0;n3;qg");
+	sim_run(T0_FREQ);
+	CHECK(!ProgramRunning && ProgramStep == 1);
+	CHECK(Program[0].Settings.StopCode == STOP_CODE_TIMEOUT);
+	CHECK(Error & ERROR_PROGRAM);
+	CHECK(CommandedChannel == 4 && Cpw == 1500 && StopOnTimeout == 0);
+	CHECK(ChannelState[4].Cpw == 1500);
+	ack("qc;n0");
+
+	// the trace covers seconds, and keeps a step too large
+	// for a delta whole
+	SimAdc[1] = 0;
+	sim_run(T0_FREQ / 10);
+	ack("j0;t0;g");
+	sim_run(T0_FREQ / 2);
+	SimAdc[1] = 600;
+	sim_run(T0_FREQ * 4);
+	{
+		int i = 0, n = 0, m = TraceStart, step = 0, v, count, start, fine;
+
+		while (i < TraceCount)
+		{
+			if (Trace[i] == TRACE_ESCAPE)
+			{
+				v = (uint8_t)Trace[i + 1] << 8 | (uint8_t)Trace[i + 2];
+				i += 3;
+			}
+			else
+				v = m + Trace[i++];
+			if (abs(v - m) > step) step = abs(v - m);
+			m = v;
+			++n;
+		}
+		CHECK(i == TraceCount && m == TraceLast && m == Milliamps);
+		CHECK(step > 127);
+		CHECK(TraceFine * TRACE_PRESCALE + (n - TraceFine) * TRACE_PRESCALE * TRACE_DECIMATE >= 3 * CU_FREQ);
+		sim_clear_output();
+		sim_send("m");
+		sim_step();
+		CHECK(sscanf(SimOutput, "M%d %d %d", &count, &start, &fine) == 3);
+		CHECK(count == TraceCount && start == TraceStart && fine == TraceFine);
+	}
+	ack("s");
+	SimAdc[1] = 0;
+
+	// a binary report is 'B', the number of bytes, and the
+	// fields, with ETX and 7D escaped: here Cpw 047D and
+	// StopOnTimeout 0303
+	{
+		const uint8_t *s = (const uint8_t *)SimOutput;
+		uint8_t b[32];
+		int i, n;
+
+		ack("p1149;t7.71");
+		sim_clear_output();
+		sim_send("rb");
+		sim_send("r");
+		sim_step();
+		for (i = n = 0; i < SimOutputLength && n < 32; ++n)
+		{
+			if (s[i] == 0x7D) b[n] = s[i + 1] ^ 0x20, i += 2;
+			else b[n] = s[i++];
+		}
+		CHECK(n < SimOutputLength && memchr(s, 0x03, SimOutputLength) == NULL);
+		CHECK(n > 18 && b[0] == 'B' && b[1] == 16);
+		CHECK(b[2] == Channel && (b[3] << 8 | b[4]) == 1149);
+		CHECK((b[10] << 8 | b[11]) == 771 && (b[14] << 8 | b[15]) == Vps);
+		CHECK((b[16] << 8 | b[17]) == Error);
+		ack("rt;t0");
+	}
+
+#ifdef _ISR_PROBES
+	// "wr" clears ERROR_TIMING along with the statistics
+	Error |= ERROR_TIMING;
+	CHECK(!(ack("wr") & ERROR_TIMING));
+	CHECK(Probe[PROBE_T0].Count == 0);
+#endif
+
+#ifdef _REPLY_SEQ
+	// each reply ends with its sequence number
+	{
+		static const char *Commands[] = { "a5", "z", "a-12" };
+		uint8_t seq = ReplySeq, i;
+		unsigned got_seq;
+		char *end;
+
+		for (i = 0; i < 3; ++i)
+		{
+			sim_clear_output();
+			sim_send(Commands[i]);
+			sim_step();
+			end = strchr(SimOutput, '#');
+			CHECK(end && sscanf(end + 1, "%2x", &got_seq) == 1);
+			CHECK(end && strcmp(end + 3, "\n") == 0);
+			CHECK(end && got_seq == (uint8_t)(seq + i));
+		}
+		CHECK(strncmp(SimOutput, "A  -12", 6) == 0);
+	}
+#endif
+
+#ifdef _STAGE_PROFILE
+	// each stage's clocks, as estimated from host time (see
+	// sim.h): not exact, but never 0 for a stage that ran
+	{
+		uint8_t s;
+
+		ack("wr;g");
+		sim_run(T0_FREQ * 2);
+		sim_clear_output();
+		sim_send("r");
+		sim_send("wp");
+		sim_step();
+		printf("%s", strchr(SimOutput, 'S'));
+		for (s = 0; s < STAGES; ++s)
+			CHECK(StageCalls[s] && StageClocks[s] && StageMax[s]);
+		ack("s");
+	}
+#endif
+
+#ifdef _RX_PARSER
+	// isr_rx's arguments read as TryInput()'s do
+	ack("t0.05");
+	CHECK(StopOnTimeout == 5);
+	ack("T1.239");							// extra decimals truncated
+	CHECK(StopOnTimeout == 123);
+	ack("t2");
+	CHECK(StopOnTimeout == 200);
+	CHECK(ack("t400") & ERROR_TIMEOUT);		// out of range once scaled
+	CHECK(StopOnTimeout == 200);
+	CHECK(ack("p99999") & ERROR_CPW);		// too many digits
+	ack("l10;l-10");
+	CHECK(!StopOnLimit0);
+	ack("l10;l-10x");						// the rest of the argument is ignored
+	CHECK(!StopOnLimit0);
+	ack("p1300;0");
+	CHECK(Cpw == CPW_CTR);
+	CHECK(ack("x;p1500") & ERROR_COMMAND);
+	CHECK(Cpw == 1500);
+	ack("t0");
+
+	// a message may hold several commands, separated by 
+	// whitespace, and none is carried out if its CRC is bad;
+	// the message after a bad one is lost with it, as the
+	// receiver can't tell which ETX ended the bad one
+	ack("p1300 t0.07\tl10");
+	CHECK(Cpw == 1300 && StopOnTimeout == 7 && StopOnLimit0);
+	SimRxCorrupt = TRUE;
+	sim_send("p1400 t0.09");
+	SimRxCorrupt = FALSE;
+	sim_send("t0.08");
+	CHECK(ack("") & ERROR_CRC);
+	CHECK(Cpw == 1300 && StopOnTimeout == 7);
+	CHECK(!(ack("") & ERROR_CRC));
+
+	// an ETX in either byte of the CRC code doesn't end the
+	// message early; one in the message spoils it
+	{
+		char cmd[8];
+		int n, shift;
+
+		for (shift = 0; shift <= 8; shift += 8)
+		{
+			for (n = 1000; n < 2000; ++n)
+			{
+				sprintf(cmd, "p%d", n);
+				if ((uint8_t)(sim_crc(cmd) >> shift) == 0x03) break;
+			}
+			CHECK(n < 2000);
+			ack(cmd);
+			CHECK(Cpw == n);
+		}
+		CHECK(ack("p1\x03" "500") & ERROR_CRC);
+		CHECK(Cpw == n);
+	}
+	ack("l-10;t0");
+
+	// commands queue while the main loop is busy, -RTS holds
+	// the host off before the queue fills, and 'o' reports
+	// each command lost and the deepest the queue got
+	{
+		int i, lost, depth;
+
+		ack("or");
+		SimMainBusy = TRUE;
+		for (i = 0; i < RX_QUEUE + 2; ++i)
+			sim_send("p1500");
+		sim_step();
+	#ifdef _RX_FLOW_CONTROL
+		CHECK(SimReg[SIM_PBOUT] & SIM_RTS);
+		CHECK(RxDepthMax == RX_RTS_DEPTH);
+		SimMainBusy = FALSE;
+		sim_run(RX_QUEUE);
+		CHECK(!(SimReg[SIM_PBOUT] & SIM_RTS));
+		CHECK(RxbEmpty() && RxOverruns == 0);
+		SimMainBusy = TRUE;
+	#endif
+		SimIgnoreRts = TRUE;				// a host without flow control
+		for (i = 0; i < RX_QUEUE + 2; ++i)
+			sim_send("p1500");
+		sim_step();
+		SimMainBusy = FALSE;
+		SimIgnoreRts = FALSE;
+		sim_clear_output();
+		sim_send("o");
+		sim_run(2);							// after -RTS falls
+		CHECK(sscanf(SimOutput, "O%d %d", &lost, &depth) == 2);
+		CHECK(lost == 3 && depth == RX_QUEUE - 1);
+		CHECK(ack("or") & ERROR_BUF_OVFL);
+		CHECK(!(ack("") & ERROR_BUF_OVFL));
+	}
+#endif
+
+	printf("%s\n", Failures ? "FAILED" : "passed");
+	return Failures != 0;
+}
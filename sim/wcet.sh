@@ -0,0 +1,217 @@
+#!/bin/sh
+# Usage: wcet.sh LISTING CO_MAX_RESERVE CO_MIN_RESERVE T0_CLOCKS IRQ_CLOCKS DO_CO [BOUNDS [EXTERNS]]
+#
+# Bounds the system clocks the pulse timing code takes on
+# the eZ8, from LISTING: irq.c as ZDS II compiles it (the
+# .src that keepasm keeps in the Debug\ output directory).
+# Each instruction counts the most clocks its mnemonic takes
+# in any addressing mode (from the instruction summary of
+# the eZ8 CPU user manual), each call the most its callee
+# takes, and each conditional branch the longer way; a call
+# through the do_CO pointer counts the slowest of the DO_CO
+# functions. Fails if
+#
+#	CO_MAX_RESERVE	< isr_timer1, and isr_timer0 to its EI
+#	CO_MIN_RESERVE	< isr_timer1 to the first instruction of
+#					  its body, SERVO_CP_low()
+#	T0_CLOCKS		< isr_timer0 with the slowest do_CO,
+#					  and one isr_timer1
+#
+# each interrupt counting IRQ_CLOCKS more, for the
+# interrupted instruction to finish and the vectoring.
+#
+# A function with a loop needs its bound in BOUNDS, as
+# "function=iterations ..."; a call to a routine not in
+# LISTING (one of the runtime library's) needs its clocks
+# in EXTERNS, as "routine=clocks ...". What can't be
+# followed (an unknown mnemonic, an indirect jump, nested
+# loops, a recursive call) fails the check, rather than
+# counting for nothing.
+
+[ -r "$1" ] || { echo "wcet.sh: no $1; build irq.c with ZDS II first" >&2; exit 1; }
+
+sed 's/\r$//' "$1" |
+awk -v co_max="$2" -v co_min="$3" -v t0_clocks="$4" -v irq="$5" \
+	-v do_co="$6" -v bounds="$7" -v externs="$8" '
+	function fail(msg)
+	{
+		print "wcet.sh: " msg > "/dev/stderr"
+		failed = 1
+		exit 2
+	}
+
+	# the clocks of instruction i of function f, with its callee
+	function cost(f, i,		op, a, c, n, k, t, name, w, most)
+	{
+		op = Op[f, i]; a = Args[f, i]; c = Clocks[op]
+		if (op != "CALL") return c
+		if (a ~ /^@/)
+		{
+			if (do_co == "") fail(f ": indirect call, and no DO_CO")
+			n = split(do_co, t, " ")
+			most = 0
+			for (k = 1; k <= n; ++k)
+				if ((w = wcet(t[k], 0)) > most) most = w
+			return c + most
+		}
+		name = a; sub(/^_/, "", name)
+		if (name in Seen) return c + wcet(name, 0)
+		if (name in Extern) return c + Extern[name]
+		fail(f ": calls " name ", not in the listing or EXTERNS")
+	}
+
+	# where instruction i of f jumps: the index of its label,
+	# or -1 and Tail set to the function it jumps to
+	function target(f, i,		a, n, t)
+	{
+		n = split(Args[f, i], t, ",")
+		a = t[n]
+		if (a ~ /^@/) fail(f ": indirect jump")
+		if ((f, a) in At) return At[f, a]
+		sub(/^_/, "", a)
+		if (a in Seen) { Tail = a; return -1 }
+		fail(f ": jumps to " a ", not in the listing")
+	}
+
+	# the longest path from instruction i of f to its return
+	# (mode 0), its first EI (1), or the first instruction
+	# past its register saves (2)
+	function path(f, i, mode,		op, c, best, t, p)
+	{
+		if ((f, i, mode) in Memo) return Memo[f, i, mode]
+		if (i > Count[f]) fail(f ": runs off its end")
+		op = Op[f, i]
+		c = cost(f, i)
+		best = 0
+		if (op == "RET" || op == "IRET" || (mode == 1 && op == "EI") ||
+			(mode == 2 && op != "PUSH" && op != "PUSHX" && op != "SRP"))
+			return Memo[f, i, mode] = c
+		if (op == "JP" || op == "JR" || op == "DJNZ" || op ~ /^BTJ/)
+		{
+			Tail = ""
+			t = target(f, i)
+			if (t < 0) best = wcet(Tail, 0)
+			else if (t > i) best = path(f, t, mode)
+			if ((op == "JP" || op == "JR") && index(Args[f, i], ",") == 0)
+				return Memo[f, i, mode] = c + best
+		}
+		p = path(f, i + 1, mode)
+		if (p > best) best = p
+		return Memo[f, i, mode] = c + best
+	}
+
+	# each loop (a jump back) counts its body Bound times over
+	function loops(f,		i, k, t, hi, body, n)
+	{
+		n = hi = 0
+		for (i = 1; i <= Count[f]; ++i)
+		{
+			if (Op[f, i] != "JP" && Op[f, i] != "JR" && Op[f, i] != "DJNZ" && Op[f, i] !~ /^BTJ/)
+				continue
+			t = target(f, i)
+			if (t < 0 || t > i) continue
+			if (!(f in Bound)) fail(f ": has a loop; give its bound in BOUNDS")
+			if (hi && t <= hi) fail(f ": has nested loops")
+			hi = i
+			body = 0
+			for (k = t; k <= i; ++k)
+				body += cost(f, k)
+			n += Bound[f] * body
+		}
+		return n
+	}
+
+	function wcet(f, mode,		n)
+	{
+		if (!(f in Seen)) fail("no function " f " in the listing")
+		if ((f, mode) in Wcet) return Wcet[f, mode]
+		if (f in Active) fail(f ": is recursive")
+		Active[f] = 1
+		n = path(f, 1, mode) + loops(f)
+		delete Active[f]
+		return Wcet[f, mode] = n
+	}
+
+	function check(name, n, budget)
+	{
+		printf "%-23s %5d of %5d clocks\n", name, n, budget
+		if (n > budget) over = 1
+	}
+
+	BEGIN {
+		# eZ8 clocks, each mnemonic at its slowest addressing mode
+		split("ADC ADD AND CP OR SBC SUB TCM TM XOR", t, " ")
+		for (k in t) Clocks[t[k]] = 4
+		split("ADCX ADDX ANDX CPX ORX SBCX SUBX TCMX TMX XORX", t, " ")
+		for (k in t) Clocks[t[k]] = 3
+		split("CLR COM DA DEC INC RL RLC RR RRC SRA SWAP", t, " ")
+		for (k in t) Clocks[t[k]] = 3
+		split("ATM BCLR BIT BRK BSET BSWAP CCF DI EI HALT NOP RCF SCF SRP STOP WDT", t, " ")
+		for (k in t) Clocks[t[k]] = 2
+		Clocks["CPC"] = 5;	Clocks["CPCX"] = 4;	Clocks["SRL"] = 4
+		Clocks["LD"] = 4;	Clocks["LDX"] = 4;	Clocks["LEA"] = 3;	Clocks["LEAW"] = 5
+		Clocks["LDWX"] = 5;	Clocks["LDC"] = 9;	Clocks["LDCI"] = 9
+		Clocks["LDE"] = 5;	Clocks["LDEI"] = 9
+		Clocks["PUSH"] = 3;	Clocks["PUSHX"] = 3; Clocks["POP"] = 3;	Clocks["POPX"] = 3
+		Clocks["INCW"] = 6;	Clocks["DECW"] = 6;	Clocks["MULT"] = 8
+		Clocks["BTJ"] = 4;	Clocks["BTJZ"] = 4;	Clocks["BTJNZ"] = 4
+		Clocks["JP"] = 3;	Clocks["JR"] = 3;	Clocks["DJNZ"] = 4
+		Clocks["CALL"] = 6;	Clocks["RET"] = 4;	Clocks["IRET"] = 5;	Clocks["TRAP"] = 6
+
+		split("ALIGN DB DEFINE DL DS DW END EQU FILE INCLUDE ORG SEGMENT VAR VECTOR XDEF XREF", t, " ")
+		for (k in t) Directive[t[k]] = 1
+
+		n = split(bounds, t, " ")
+		for (k = 1; k <= n; ++k) { split(t[k], kv, "="); Bound[kv[1]] = kv[2] }
+		n = split(externs, t, " ")
+		for (k = 1; k <= n; ++k) { split(t[k], kv, "="); Extern[kv[1]] = kv[2] }
+	}
+
+	{
+		sub(/;.*/, "")
+		line = $0
+		if (match(line, /^[A-Za-z_$?.@][A-Za-z0-9_$?.@]*:/))
+		{
+			label = substr(line, 1, RLENGTH - 1)
+			line = substr(line, RLENGTH + 1)
+			if (label ~ /^_[A-Za-z]/)
+			{
+				fn = substr(label, 2)
+				Seen[fn] = 1
+				Count[fn] = 0
+			}
+			else if (fn != "")
+				At[fn, label] = Count[fn] + 1
+		}
+		if (line !~ /[^ \t]/) next
+		sub(/^[ \t]+/, "", line)
+		op = toupper(line); sub(/[ \t].*/, "", op)
+		args = line; sub(/^[^ \t]+/, "", args); gsub(/[ \t]/, "", args)
+		if (op ~ /^\./ || op in Directive)
+		{
+			if (op == "SEGMENT") fn = ""
+			next
+		}
+		if (fn == "") next
+		if (!(op in Clocks)) fail(fn ": unknown instruction " op)
+		n = ++Count[fn]
+		Op[fn, n] = op
+		Args[fn, n] = args
+	}
+
+	END {
+		if (failed) exit 2
+		t0_ei = wcet("isr_timer0", 1)
+		t0 = wcet("isr_timer0", 0)
+		t1 = wcet("isr_timer1", 0)
+		t1_low = wcet("isr_timer1", 2)
+		printf "%-23s %5d clocks, %d to EI\n", "isr_timer0", t0, t0_ei
+		printf "%-23s %5d clocks, %d to its body\n", "isr_timer1", t1, t1_low
+		n = split(do_co, t, " ")
+		for (k = 1; k <= n; ++k)
+			printf "%-23s %5d clocks\n", t[k], wcet(t[k], 0)
+		check("CO_MAX_RESERVE", irq + t1 + irq + t0_ei, co_max)
+		check("CO_MIN_RESERVE", irq + t1_low, co_min)
+		check("T0 tick", irq + t0 + irq + t1, t0_clocks)
+		exit over
+	}'
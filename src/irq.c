@@ -18,6 +18,17 @@
 // Store big strings in ROM to conserve RData and EData space.
 rom char FIRMWARE[]	= R"Aeon Laboratories SC64 ";
 rom char VERSION[]	= R"V.20220823-0000";
+rom char HEX_DIGITS[] = R"0123456789ABCDEF";
+rom uint16_t POWERS_OF_TEN[] = { 10000, 1000, 100, 10, 1 };
+
+// Baud rates (in hundreds) for the 'b' command, and their
+// baud rate generator values, SYS_FREQ / (16 * baud). 
+// 230400 and 460800 aren't exact divisions of 5.5296 MHz,
+// so 172800 and 345600 are offered instead.
+#define BAUD_RATES				3
+#define BAUD_FALLBACK			0		// the SYS_BAUD rate
+rom uint16_t BAUD_HUNDREDS[BAUD_RATES] = { 1152, 1728, 3456 };
+rom uint8_t BAUD_BRG[BAUD_RATES] = { 3, 2, 1 };
 
 #define SERNO					28
 
@@ -276,6 +287,39 @@ rom char VERSION[]	= R"V.20220823-0000";
 #define A2_OFFSET				952.1
 #endif
 
+///////////////////////////////////////////////////////
+// Fixed-point calibration
+//
+// The float constants above are folded by the compiler into
+// scaled integers, so that no floating point math is done
+// at run time. Ain carries ADC_FRACTION_BITS fractional
+// bits, so with F = ADC_FRACTION_BITS,
+//		value = (gain * 2^CAL_Q * Ain - gain * offset * 2^(CAL_Q+F)) / 2^(CAL_Q+F)
+//
+// gain_q * Ain must stay below 2^31, i.e., gain * Ain < 
+// 2^(31 - CAL_Q). With CAL_Q = 12 and F = 1, that holds for
+// any gain < 128 over the full 0..2047 count range (Ain < 
+// 2^12). The result must also fit in 16 bits. It differs 
+// from the float computation by at most 1 (mA or mV); 
+// sim/test_calibration.c checks this.
+//
+#define CAL_Q					12
+#define CAL_SHIFT				(CAL_Q + ADC_FRACTION_BITS)
+#define CAL_SCALE(x, q)			((int32_t)((x) * (1L << (q)) + 0.5))
+
+#define A1_GAIN_Q				CAL_SCALE(A1_GAIN, CAL_Q)
+#define A1_BIAS_Q				CAL_SCALE(A1_GAIN * A1_OFFSET, CAL_SHIFT)
+#define A2_GAIN_Q				CAL_SCALE(A2_GAIN, CAL_Q)
+#define A2_BIAS_Q				CAL_SCALE(A2_GAIN * A2_OFFSET, CAL_SHIFT)
+
+// T1 clocks per microsecond, scaled by 2^CO_Q. Rounding up
+// the constant makes whole-tick pulse widths (e.g., 625 us
+// == 3456 T1 clocks) come out exact. Any legal Cpw is
+// converted to within 1 T1 clock of the float result.
+//		CPW_MAX * CO_PER_US_Q < 2^31
+#define CO_Q					14
+#define CO_PER_US_Q				((uint32_t)(T1_FREQ * (float)(1L << CO_Q) / 1000000.0 + 0.5))
+
 #define CHANNELS				64
 #define CHANNEL_NONE			(CHANNELS-1)	// last channel 'none' until ADDR_EN added to hardware
 
@@ -286,6 +330,35 @@ rom char VERSION[]	= R"V.20220823-0000";
 
 #define SKIP_INRUSH				20		// 100ths of a second ('elapsed' units)
 
+// Stall detection
+// A stalled motor draws about the same current as it did 
+// at start-up (locked rotor), so the servo is considered 
+// stalled when, after the inrush, the filtered current 
+// levels off at StopOnStall percent or more of the inrush
+// peak. The current is "level" if it changes by no more 
+// than STALL_SLOPE_MAX milliamps over the window of
+// STALL_WINDOW samples, taken every STALL_PRESCALE 
+// controller updates (160 ms at the defaults). An inrush 
+// peak under STALL_PEAK_MIN means the servo isn't drawing
+// current (disconnected, or no load); its level near-zero
+// current would otherwise look like a stall.
+#define STALL_FILTER_SHIFT		2		// IIR filter, time constant ~2^n controller updates
+#define STALL_WINDOW			8
+#define STALL_PRESCALE			4
+#define STALL_SLOPE_MAX			20		// milliamps per window
+#define STALL_PEAK_MIN			20		// milliamps
+
+// Stop reasons (StopReason bits)
+#define STOP_NONE				0
+#define STOP_LIMIT0				1
+#define STOP_LIMIT1				2
+#define STOP_CURRENT			4		// StopOnMilliamps
+#define STOP_TIMEOUT			8		// StopOnTimeout
+#define STOP_STALL				16		// StopOnStall
+#define STOP_FRAME				32		// every frame slot has stopped
+#define STOP_COMMAND			64		// stopped by a command
+#define STOP_CODE_TIMEOUT		4		// StopCode for STOP_TIMEOUT
+
 
 // The CO_MAX_RESERVE provides time for the "stop pulse"
 // interrupt service routine, plus the time at the start
@@ -307,6 +380,10 @@ rom char VERSION[]	= R"V.20220823-0000";
 //
 #define CO_MAX_RESERVE			150		// T1 clocks, for minimum reserve,
 										// assuming T1_CLOCK_FREQ == SYS_FREQ
+// With _ISR_PROBES, ERROR_TIMING reports any isr_timer0 entry 
+// or pulse end that is later than this, until the next "wr".
+// "make -C sim wcet" checks the ZDS II listing of this file
+// against it, and against CO_MIN_RESERVE (see sim/wcet.sh).
 
 #define CO_MAX					(CO_PERIOD * T1_CLOCK_FREQ / T0_FREQ - CO_MAX_RESERVE)
 #if CO_MAX > TIMER_MAX
@@ -333,12 +410,46 @@ rom char VERSION[]	= R"V.20220823-0000";
 #endif
 
 
+#ifdef _T1OUT_PULSE
+#define CPW_MIN					1				// microseconds; Timer 1 ends the pulse, not isr_timer1
+#else
 #define CPW_MIN					5				// microseconds, based on CO_MIN_RESERVE
+#endif
 #define CPW_CTR					1500			// nominal center
 //#define CPW_MAX					2995			// microseconds, based on equal about center
 #define CPW_MAX					11851			// limited by CO_MAX: CPW_MAX = CO_MAX * 1000000.0 / T1_FREQ
 
 
+///////////////////////////////////////////////////////
+// Multi-servo frames
+//
+// A CO period is CO_PERIOD T0 ticks long, but a servo 
+// pulse rarely needs more than one tick. In frame mode, 
+// each T0 tick is a "slot" that drives a different channel,
+// so up to FRAME_SLOTS servos move at the same time, each 
+// still receiving one pulse per CO period. (Raising T0_FREQ
+// to 400 would give 8 slots of 2.5 ms each.)
+//
+// Limit switches are sampled per slot, just before the 
+// address lines are switched away from the slot's channel.
+// Servo current is the total for all moving servos, so 
+// StopOnMilliamps stops the whole frame.
+//
+#define FRAME_SLOTS				CO_PERIOD
+#define SLOT_NONE				0xFF
+
+#define SLOT_CO_MAX				(T1_CLOCK_FREQ / T0_FREQ - CO_MAX_RESERVE)
+#if SLOT_CO_MAX > TIMER_MAX
+	#undef SLOT_CO_MAX
+	#define SLOT_CO_MAX			TIMER_MAX
+#endif
+
+// FrameFlags bits; the stop-on-limit bits match the gpio pins
+#define SLOT_RUN				0x80
+#define SLOT_STOP_ON_LIMIT0		LIMIT0
+#define SLOT_STOP_ON_LIMIT1		LIMIT1
+
+
 ///////////////////////////////////////////////////////
 //
 // global variables
@@ -346,24 +457,108 @@ rom char VERSION[]	= R"V.20220823-0000";
 
 volatile uint16_t T0Ticks;		// rolls over when max unsigned int is reached
 
-#define ANALOG_INPUTS			2
+// isr_timer0() work for each tick of the schedule
+#define TICK_CO					0x01
+#define TICK_CU					0x02
+#define TICK_SERVICE			0x04
+#define T0_TICK(i)				(((i) % CO_PERIOD == 0 ? TICK_CO : 0) | \
+								 ((i) % CU_PERIOD == 0 ? TICK_CU : 0) | \
+								 ((i) % SERVICE_PERIOD == 0 ? TICK_SERVICE : 0))
+
+// Only the first T0_SCHEDULE_TICKS entries are used
+rom uint8_t T0_SCHEDULE[T0_SCHEDULE_MAX] =
+{
+	T0_TICK(0),  T0_TICK(1),  T0_TICK(2),  T0_TICK(3),
+	T0_TICK(4),  T0_TICK(5),  T0_TICK(6),  T0_TICK(7),
+	T0_TICK(8),  T0_TICK(9),  T0_TICK(10), T0_TICK(11),
+	T0_TICK(12), T0_TICK(13), T0_TICK(14), T0_TICK(15)
+};
+uint8_t T0Phase;				// T0_SCHEDULE index
+uint16_t T0SecondTicks;			// counts down to the next second
+
+#define ANALOG_INPUTS			2			// max 8
 uint8_t Ach[ANALOG_INPUTS] = { 1, 2 };		// SERVO_I = ANA1, SERVO_V = ANA2
-int Ain[ANALOG_INPUTS];
+
+// The order in which the analog inputs (indexes into Ach[])
+// are sampled, one block of ADC_BLOCK readings per entry.
+// Every change of input costs ADC_SETTLING_TIME readings, 
+// but consecutive entries for the same input do not, so
+// listing an input n times in a row gives it n times the
+// share of ADC time. Here, the servo current (which sets 
+// the stop latency) is sampled 8 times as often as the 
+// slowly-changing supply voltage.
+// To add a spare input (e.g., PC0/ANA4), append its adc 
+// channel to Ach[], configure the pin as an analog input 
+// in gpio.h, and list its index here.
+#define ADC_SCHEDULE_LENGTH		9
+rom uint8_t AdcSchedule[ADC_SCHEDULE_LENGTH] = { 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+int Ain[ANALOG_INPUTS];						// adc counts * 2^ADC_FRACTION_BITS
 #define AdcServoCurrent			Ain[0]
 #define AdcServoVoltage			Ain[1]
 
-int AdcIn;
-int StabilityMeter;							// Performance metric
-
-
-volatile BOOL EnableControllerUpdate = TRUE;
+#if ANALOG_INPUTS > 8
+	#error ANALOG_INPUTS must be <= 8 (see AdcBlockReady)
+#endif
+#if ADC_OVERSAMPLE_BITS > 4 || ADC_FRACTION_BITS > ADC_OVERSAMPLE_BITS
+	#error ADC_OVERSAMPLE_BITS or ADC_FRACTION_BITS out of range
+#endif
+#define ADC_BLOCK				(1 << ADC_OVERSAMPLE_BITS)
+#define ADC_DECIMATE_SHIFT		(ADC_OVERSAMPLE_BITS - ADC_FRACTION_BITS)
+#define ADC_ROUND				((1 << ADC_DECIMATE_SHIFT) >> 1)
+
+volatile int AdcIn;
+volatile int StabilityMeter;				// Performance metric: readings taken
+int AinNoise[ANALOG_INPUTS];				// peak-to-peak adc counts in the last block
+volatile uint16_t AinBlocks[ANALOG_INPUTS];	// Ain updates since AdcStatsTicks
+far uint16_t AdcStatsTicks;					// T0Ticks when the AinBlocks count started
+
+// blocks finished by isr_adc, waiting for check_adc
+volatile int AdcBlockAin[ANALOG_INPUTS];
+volatile int AdcBlockNoise[ANALOG_INPUTS];
+volatile uint8_t AdcBlockReady;				// bit i set: AdcBlockAin[i] is new
+
+
+// Main loop tasks, highest priority first. isr_timer0 
+// (or isr_adc) releases a task by setting its TaskPending 
+// bit; the main loop runs it when task_due() says so. A 
+// task that is still pending at its next release has 
+// skipped one; one that starts more than TASK_DEADLINE
+// ticks after its release has missed its deadline.
+#define TASK_CU					0		// update_controller(): stop conditions and CO
+#define TASK_ADC				1		// check_adc(), released by isr_adc
+#define TASK_COMMANDS			2		// do_commands(), polled every CU_PERIOD
+#define TASK_DATALOG			3		// Datalogging, every second
+#define TASKS					4
+rom uint8_t TASK_DEADLINE[TASKS] = { CU_PERIOD, CU_PERIOD, 2 * CO_PERIOD, T0_FREQ / 10 };
+
+#define TASK_RELEASE(t)			{ if (TaskPending & (1 << (t))) ++TaskSkips[t]; \
+								  else { TaskPending |= 1 << (t); TaskReleased[t] = T0Ticks; } }
+
+volatile uint8_t TaskPending;			// bit t: task t has been released
+volatile far uint16_t TaskReleased[TASKS];	// T0Ticks at release
+volatile far uint16_t TaskSkips[TASKS];	// releases while still pending
+far uint16_t TaskMisses[TASKS];			// late starts
+far uint16_t TaskLateMax[TASKS];		// worst start delay, in T0 ticks
 
-volatile BOOL EnableDatalogging;
 uint8_t DatalogCount;					// counter for Datalogging
 uint8_t DatalogReset = -1;				// report every (this many + 1) seconds
 	// Note: -1 == 0xFF == 255 is used as a disable value (DatalogReset is actually unsigned)
 	// This is convenient because the reset value needs to be one 
 	// less than the desired count.
+far BOOL BinaryReports;					// 'r' and Datalogging send report_binary()
+
+// Baud rate switching. The new rate takes effect once the
+// acknowledgement has left the UART: U0_TXE (transmit data
+// and shift registers empty) must stay set for TX_IDLE_POLLS
+// reads in a row, longer than a character time at 115200 
+// (~480 clocks), so the gap while uart.c reloads the data
+// register between characters isn't taken for the end.
+#define U0_TXE					0x02	// U0STAT0 transmitter empty
+#define TX_IDLE_POLLS			128
+far uint8_t BaudRate;					// BAUD_HUNDREDS index in use
+far uint8_t BaudPending;				// index to switch to, or BAUD_RATES if none
+far BOOL BaudTrial;						// waiting for a valid command at the new rate
+far uint16_t BaudTicks;					// t0_ticks() when the trial began
 
 uint16_t CO;							// this is the servo command signal
 reentrant void (*do_CO)();				// a pointer to the function that produces the CO signal
@@ -384,12 +579,239 @@ BOOL Limit0;							// LIMIT0_DETECTED
 BOOL StopOnLimit1;						// stop when limit1 reached
 BOOL Limit1;							// LIMIT1_DETECTED
 
+volatile uint16_t GoTicks;				// T0Ticks when the last 'go' was received
+volatile BOOL HopPending;				// no pulse yet since the last 'go'
+far uint16_t HopTicks;					// T0 ticks from the last 'go' to its first pulse
+far uint16_t HopTicksMax;				// worst case HopTicks since reset
+
+#ifdef _ISR_PROBES
+// ISR timing probes, in T0 clocks (system clocks at the 
+// default prescale):
+//		PROBE_T0		isr_timer0 entry, after the T0 reload
+//		PROBE_PULSE		control pulse width, less CO
+//		PROBE_ADC		time between isr_adc entries, for one
+//						pair of every PROBE_ADC_PRESCALE
+//						entries, to keep the conversions' 
+//						ISR short
+#define PROBE_T0				0
+#define PROBE_PULSE				1
+#define PROBE_ADC				2
+#define PROBES					3
+#define PROBE_BINS				10		// bin n: |sample| < 2^n (and >= 2^(n-1)); the last takes the rest
+#define PROBE_ADC_PRESCALE		16
+
+#if T0_PRESCALE != T1_PRESCALE
+#error "_ISR_PROBES times pulses with T0, so T0_PRESCALE must equal T1_PRESCALE"
+#endif
+
+typedef struct
+{
+	int Min;
+	int Max;
+	int32_t Sum;
+	uint16_t Count;						// stops at 0xFFFF
+	uint16_t Bins[PROBE_BINS];
+} PROBE;
+
+far PROBE Probe[PROBES];
+uint8_t PulseStartTicks;				// low byte of T0Ticks when the pulse started
+uint16_t PulseStartCount;				// T0 count when the pulse started
+uint16_t PulseCo;						// the pulse's commanded width
+uint8_t AdcEntryTicks;					// the same, for the isr_adc entry before a sample
+uint16_t AdcEntryCount;
+uint8_t AdcProbeDivider;				// counter for PROBE_ADC_PRESCALE
+#endif
+
+#ifdef _STAGE_PROFILE
+// Main loop stages
+#define STAGE_COMMANDS			0		// do_commands()
+#define STAGE_ADC				1		// check_adc()
+#define STAGE_DEVICE			2		// update_device()
+#define STAGE_CO				3		// update_CO()
+#define STAGE_REPORT			4		// report_device()
+#define STAGES					5
+
+far uint8_t StageStartTicks[STAGES];	// low byte of T0Ticks when the stage began
+far uint16_t StageStartCount[STAGES];	// T0 count when the stage began
+far uint16_t StageCalls[STAGES];		// stops at 0xFFFF
+far uint32_t StageClocks[STAGES];		// total T0 clocks
+far uint16_t StageMax[STAGES];			// longest, in T0 clocks
+#endif
+
+#ifdef _RX_PARSER
+far uint16_t RxOverruns;				// commands lost by isr_rx since reset
+far uint8_t RxDepthMax;					// the most RxQueue has held since reset
+#else
+far uint16_t RxOverruns;				// do_commands() that found ERROR_BUF_OVFL since reset
+far uint8_t RxBurst;					// commands found waiting by this do_commands()
+far uint8_t RxBurstMax;					// the most found by any do_commands() since reset
+#endif
+far uint16_t AckErrors;					// ERROR_COMMAND, ERROR_BUF_OVFL seen since the last 'a'
+
+volatile uint8_t LimitLatched;			// LIMITx edges seen by isr_limit (cleared by Clear())
+volatile uint16_t LastPulseTicks;		// T0Ticks when the last control pulse started
+far uint16_t LimitLatency;				// T0 ticks from the last pulse start to the limit edge
+
 uint16_t StopOnMilliamps;				// stop if current exceeds this many milliamps
 uint16_t Milliamps;						// SERVO_I, actuator motor current in milliamps
 uint16_t StopOnTimeout;					// stop after this many hundredths of a second
 volatile uint16_t Elapsed;				// 100ths of a second since servo started
 #define ELAPSED_RESET			32767
 
+far uint8_t StopOnStall;				// stall threshold, percent of InrushPeak; 0 = disabled
+far uint16_t InrushPeak;				// peak filtered milliamps during SKIP_INRUSH
+far uint16_t StallFilter;				// filtered milliamps * 2^STALL_FILTER_SHIFT
+far uint16_t StallHistory[STALL_WINDOW];	// filtered milliamps
+far uint8_t StallIndex;
+far uint8_t StallSamples;				// valid StallHistory entries
+uint8_t StallDivider;					// counter for STALL_PRESCALE
+far int StallSlope;						// milliamps change over the window
+
+far uint8_t StopReason;					// STOP_xxx bits, for the most recent stop
+far uint16_t StopElapsed;				// Elapsed at the most recent stop
+far uint8_t StopChannel;				// CommandedChannel at the most recent stop
+far uint16_t StopPeak;					// MovePeak at the most recent stop
+far uint16_t MovePeak;					// peak milliamps since the last 'go'
+
+far BOOL EnableEvents;					// send a stop event as soon as it happens
+far BOOL StopEventPending;				// a stop hasn't been sent yet
+
+// Packed servo settings, for the channel table and the
+// move program. StopCode is the lowest StopReason bit 
+// number + 1, from the most recent stop (0 if none).
+// WaitForStop is for program steps only: the step must
+// end on a limit, current, or stall stop, and a timeout
+// halts the program instead of starting the next step.
+typedef struct
+{
+	uint16_t Cpw : 14;					// CPW_MAX < 2^14
+	uint16_t StopOnLimit0 : 1;
+	uint16_t StopOnLimit1 : 1;
+	uint16_t StopOnTimeout : 15;		// TIMEOUT_MAX < 2^15
+	uint16_t WaitForStop : 1;
+	uint16_t StopOnMilliamps : 13;		// CURRENT_MAX < 2^13
+	uint16_t StopCode : 3;
+} CHANNEL_STATE;
+
+#ifdef _CHANNEL_TABLE
+// The settings of every channel are kept here, and
+// loaded into the globals above when the channel is 
+// selected, so they needn't be resent for every move.
+far CHANNEL_STATE ChannelState[CHANNELS];
+#endif
+
+#if PROGRAM_STEPS > 0
+// A list of moves, run one after another by update_program().
+// Each step runs until one of its stop conditions is met;
+// its StopCode records why.
+typedef struct
+{
+	uint8_t Channel;
+	CHANNEL_STATE Settings;
+} PROGRAM_STEP;
+
+far PROGRAM_STEP Program[PROGRAM_STEPS];
+far uint8_t ProgramSize;				// steps in use
+far uint8_t ProgramStep;				// the step in progress
+far BOOL ProgramRunning;
+far BOOL StepStarted;					// Program[ProgramStep] has been started
+far BOOL StepSettings;					// the globals hold a step's settings, not the channel's
+#endif
+
+far uint8_t FrameSize;					// number of slots in use
+far uint8_t FrameChannel[FRAME_SLOTS];
+far uint8_t FrameFlags[FRAME_SLOTS];	// SLOT_RUN, SLOT_STOP_ON_LIMITx
+volatile far uint8_t FrameLimits[FRAME_SLOTS];	// LIMITx detected (set by outputSlot)
+far uint16_t FrameCpw[FRAME_SLOTS];
+far uint16_t FrameCo[FRAME_SLOTS];
+far uint16_t FrameTimeout[FRAME_SLOTS];	// StopOnTimeout for each slot
+BOOL FrameRunning;						// frame mode instead of CommandedChannel
+volatile BOOL FrameActive;				// isr_timer0 runs do_CO every tick
+volatile uint8_t FrameSlot;				// the slot for the next T0 tick
+far uint8_t FrameAddressed;				// the slot whose channel is selected
+
+#if TRACE_SIZE > 255
+	#error TRACE_SIZE must be <= 255
+#endif
+#if TRACE_PRESCALE * TRACE_DECIMATE > 256
+	#error TRACE_PRESCALE * TRACE_DECIMATE must be <= 256
+#endif
+#define TRACE_ESCAPE			-128	// the next two bytes are Milliamps
+#if TRACE_SIZE > 0
+far int8_t Trace[TRACE_SIZE];			// Milliamps deltas
+far uint8_t TraceCount;					// bytes recorded
+far uint8_t TraceFine;					// samples recorded before TRACE_DECIMATE applied
+uint8_t TraceDivider;					// counter for TRACE_PRESCALE
+far uint16_t TraceStart;				// Milliamps when the move started
+far uint16_t TraceLast;					// Milliamps as reconstructed from the trace
+#endif
+
+#if defined(_RX_FLOW_CONTROL) && !defined(_RX_PARSER)
+	#error _RX_FLOW_CONTROL needs _RX_PARSER, to see how full the queue is
+#endif
+#ifdef _RX_PARSER
+// Commands parsed by isr_rx as their characters arrive.
+// The argument is kept as its digits' value and the number
+// of them after the '.', so rx_input() can scale it to any 
+// command's decimals without the text. Fraction digits past
+// RX_FRAC_MAX are dropped, as TryInput() would truncate.
+#define U0_OE					0x20	// U0STAT0 receive overrun
+#define RX_FRAC					0x03	// Flags: fraction digits
+#define RX_FRAC_MAX				2
+#define RX_POINT				0x04	// Flags: '.' seen
+#define RX_ARG					0x08	// Flags: a digit seen (NargPresent)
+#define RX_NEGATIVE				0x10	// Flags: '-' seen
+#define RX_OVER					0x20	// Flags: too many digits
+#define RX_SKIP					0x40	// Flags: ignore the rest of the command
+#define RX_DIGITS_MAX			((32767 - 9) / 10)
+typedef struct
+{
+	char Letters[2];					// command, sub-command; '\0' if none
+	uint8_t Flags;
+	int Digits;							// the argument's digits, without the '.'
+} RX_COMMAND;
+
+// Message framing, as in "Servo Controller comm protocol" 
+// and "CRC Notes for Aeon serial communications": a 
+// message ends with a two-byte CRC code and ETX, and ETX
+// appears nowhere else but possibly in the CRC code.
+#define RX_ETX					0x03
+#define RX_CRC_INIT				0xFFFF
+#define RX_CRC_GOOD				0x82C0	// a message's CRC, its CRC code included
+rom uint16_t RX_CRC_NIBBLE[16] =		// CRC-16 polynomial DAAE (reversed), 4 bits at a time
+{
+	0x0000, 0xACAC, 0xEC05, 0x40A9, 0x6D57, 0xC1FB, 0x8152, 0x2DFE,
+	0xDAAE, 0x7602, 0x36AB, 0x9A07, 0xB7F9, 0x1B55, 0x5BFC, 0xF750
+};
+typedef struct
+{
+	uint8_t Held : 2;					// characters in RxHeld
+	uint8_t EtxAge : 2;					// characters since an ETX that didn't end the message, to 3
+	uint8_t Bad : 1;					// drop the message
+} RX_FRAME;
+
+far RX_COMMAND RxQueue[RX_QUEUE];		// filled by isr_rx
+volatile uint8_t RxQueueFill;			// the command being received
+volatile uint8_t RxQueueHead;			// the first of the message being received
+volatile uint8_t RxQueueTail;			// the next for do_commands(); == RxQueueHead if none
+far uint16_t RxCrc;						// of the message being received
+far char RxHeld[2];						// its last two characters: the CRC code, if ETX is next
+far RX_FRAME RxFrame;
+far RX_COMMAND RxCmd;					// the command being carried out
+
+// uart.c's command interface, for do_commands() and the handlers
+#define RxbEmpty()				(RxQueueHead == RxQueueTail)
+#define GetInput()				rx_take()
+#define Command					RxCmd.Letters
+#define NargPresent				(RxCmd.Flags & RX_ARG)
+#define Narg					rx_narg()
+#define TryInput				rx_input
+#endif
+
+#ifdef _REPLY_SEQ
+far uint8_t ReplySeq;					// the next reply's sequence number
+#endif
+
 //////////////////////////////////////////////////////
 //
 // internal prototypes
@@ -398,20 +820,61 @@ volatile uint16_t Elapsed;				// 100ths of a second since servo started
 void isr_timer0();
 void isr_timer1();
 void isr_adc();
+void isr_limit();
 reentrant void doNothing();
+reentrant void outputSlot();
 void setCpw(int);
+uint16_t calibrate(int, int32_t, int32_t);
+void trace_start();
+void trace_sample();
+void stall_start();
+BOOL update_stall();
+void update_program();
+void Clear();
+void reset_probes();
+#ifdef _RX_PARSER
+void isr_rx();
+void rx_overrun();
+void rx_clear(far RX_COMMAND *);
+void rx_start();
+void rx_take();
+int rx_narg();
+int rx_input(int, int, uint16_t, int, uint8_t);
+#endif
+#ifdef _REPLY_SEQ
+void printhex(uint8_t);
+#endif
 
 
 ///////////////////////////////////////////////////////
 // set defaults
 void init_irq()
 {
+	#ifdef _CHANNEL_TABLE
+	uint8_t n;
+	#endif
+
 	do_CO = doNothing;
+	reset_probes();
+	T0Phase = 0;
+	T0SecondTicks = T0_FREQ;
 	
 	CommandedChannel = CHANNEL_NONE;
 	Channel = 0;		// != CommandedChannel, to force a selection before doing anything
 	setCpw(CPW_CTR);
 
+	#ifdef _CHANNEL_TABLE
+	for (n = 0; n < CHANNELS; ++n)
+	{
+		ChannelState[n].Cpw = CPW_CTR;
+		ChannelState[n].StopOnLimit0 = FALSE;
+		ChannelState[n].StopOnLimit1 = FALSE;
+		ChannelState[n].StopOnTimeout = 0;
+		ChannelState[n].StopOnMilliamps = 0;
+		ChannelState[n].StopCode = 0;
+	}
+	#endif
+
 	GoCommanded = FALSE;
 	Stopped = TRUE;
 	CpEnabled = FALSE;
@@ -426,17 +889,54 @@ void init_irq()
 	StopOnTimeout = 0;
 	Elapsed = 0;
 	Error = ERROR_NONE;	
+	#ifdef _REPLY_SEQ
+	ReplySeq = 0;
+	#endif
+
+	StopOnStall = 0;
+	StopReason = STOP_NONE;
+	StopElapsed = 0;
+	StopChannel = CHANNEL_NONE;
+	StopPeak = 0;
+	MovePeak = 0;
+	EnableEvents = FALSE;
+	StopEventPending = FALSE;
+	BinaryReports = FALSE;
+	BaudRate = BAUD_FALLBACK;
+	BaudPending = BAUD_RATES;
+	BaudTrial = FALSE;
+
+	#if PROGRAM_STEPS > 0
+	ProgramSize = 0;
+	ProgramRunning = FALSE;
+	StepSettings = FALSE;
+	#endif
+
+	FrameSize = 0;
+	FrameRunning = FALSE;
+	FrameActive = FALSE;
+
+	#ifdef _RX_PARSER
+	RxQueueHead = RxQueueTail = 0;
+	rx_start();
+	#endif
 	
 	SET_VECTOR(TIMER0, isr_timer0);
 	SET_VECTOR(TIMER1, isr_timer1);
 	SET_VECTOR(ADC, isr_adc);
+	SET_VECTOR(P0AD, isr_limit);
+	SET_VECTOR(P1AD, isr_limit);
+	#ifdef _RX_PARSER
+	SET_VECTOR(UART0_RX, isr_rx);		// in place of uart.c's
+	#endif
 
-	ADC_SELECT(Ach[0]);
+	ADC_SELECT(Ach[AdcSchedule[0]]);
 	adc_reset();
 
 	EI_T0();
 	EI_T1();
 	EI_ADC();
+	EI_LIMITS();
 }
 
 
@@ -477,32 +977,239 @@ reentrant void doNothing() {}
 
 
 ///////////////////////////////////////////////////////
-reentrant void selectCommandedChannel()
+// Leaves ADDR_EN and SERVO_CP low.
+reentrant void addressChannel(uint8_t ch)
 {
 	uint8_t ta, tc;	// workspaces for bit manipulations
-	ta = PAIN & 0x3F;	// clear ADDR bits in PA (54xxxxxx)
-	tc = PCIN & 0xF0;	// clear ADDR bits in PC (xxxx3210)
+	ta = PAIN & ~ADDR_PA_MASK;	// clear ADDR bits in PA (54xxxxxx)
+	tc = PCIN & ~ADDR_PC_MASK;	// clear ADDR bits in PC (xxxx3210)
 
-	mask_set(ta, (CommandedChannel & 0x30) << 2);	// select and move PA bits of ADDR (54xxxxxx)
-	mask_set(tc, (CommandedChannel & 0x0F));  	// select and move PC bits of ADDR (xxxx3210)
+	mask_set(ta, ADDR_PA(ch));	// select and move PA bits of ADDR (54xxxxxx)
+	mask_set(tc, ADDR_PC(ch));	// select and move PC bits of ADDR (xxxx3210)
 
 	// SERVO_CP must be low when changing channel to minimize twitching
 	ADDR_EN_low();
 	SERVO_CP_low();
 	PAOUT = ta;
 	PCOUT = tc;
+	Channel = ch;
+}
+
+
+///////////////////////////////////////////////////////
+reentrant void selectCommandedChannel()
+{
+	addressChannel(CommandedChannel);
 	SERVO_CP_high();
 	ADDR_EN_high();
+}
+
+
+///////////////////////////////////////////////////////
+#if defined(_ISR_PROBES) || defined(_STAGE_PROFILE)
+#define T0_RELOAD				(SYS_FREQ / T0_PRESCALE / T0_FREQ)
+
+// Reading T0H latches T0L, so read the high byte first.
+reentrant uint16_t t0_count()
+{
+	uint16_t c = T0H;
+	return (c << 8) | T0L;
+}
+
+// T0 clocks since T0Ticks was ticks and the count was
+// count. A reload that isr_timer0 hasn't counted yet
+// makes the span come out T0_RELOAD short, and negative.
+// The tick difference is usually 0 or 1, so adding 
+// T0_RELOAD for each is cheaper than a 32-bit multiply.
+reentrant int32_t t0_span(uint8_t ticks, uint16_t count)
+{
+	int32_t span = (int32_t)t0_count() - count;
+	uint8_t n = (uint8_t)T0Ticks - ticks;
+
+	for (; n; --n)
+		span += T0_RELOAD;
+	if (span < 0) span += T0_RELOAD;
+	return span;
+}
+#endif
+
+#ifdef _ISR_PROBES
+reentrant void probe_sample(uint8_t p, int32_t v)
+{
+	far PROBE *s = &Probe[p];
+	uint16_t u;
+	uint8_t b;
+
+	if (s->Count == 0xFFFF) return;
+	if (v > 32767) v = 32767;
+	else if (v < -32767) v = -32767;
+
+	if (v < s->Min) s->Min = v;
+	if (v > s->Max) s->Max = v;
+	s->Sum += v;
+	++s->Count;
+
+	u = v < 0 ? -v : v;
+	for (b = 0; u && b < PROBE_BINS - 1; u >>= 1)
+		++b;
+	++s->Bins[b];
+}
+
+reentrant void probe_pulse_start(uint16_t co)
+{
+	PulseStartCount = t0_count();
+	PulseStartTicks = T0Ticks;
+	PulseCo = co;
+}
+#else
+#define probe_pulse_start(co)
+#endif
+
+
+///////////////////////////////////////////////////////
+#ifdef _STAGE_PROFILE
+void stage_begin(uint8_t s)
+{
+	DI();
+	StageStartCount[s] = t0_count();
+	StageStartTicks[s] = T0Ticks;
+	EI();
+}
+
+void stage_end(uint8_t s)
+{
+	int32_t span;
+
+	DI();
+	span = t0_span(StageStartTicks[s], StageStartCount[s]);
+	EI();
+	if (StageCalls[s] == 0xFFFF) return;
+	++StageCalls[s];
+	StageClocks[s] += span;
+	if (span > 0xFFFF) span = 0xFFFF;
+	if (span > StageMax[s]) StageMax[s] = span;
+}
+#else
+#define stage_begin(s)
+#define stage_end(s)
+#endif
 
-	Channel = CommandedChannel;
+
+///////////////////////////////////////////////////////
+#ifdef _T1OUT_PULSE
+#define T1_PRES_BITS			((T1_PRESCALE == 1 ? 0 : T1_PRESCALE == 2 ? 1 : \
+								  T1_PRESCALE == 4 ? 2 : T1_PRESCALE == 8 ? 3 : \
+								  T1_PRESCALE == 16 ? 4 : T1_PRESCALE == 32 ? 5 : \
+								  T1_PRESCALE == 64 ? 6 : 7) << 3)
+#define T1_ONE_SHOT				(T1_PRES_BITS | 0x00)	// TMODE 000
+
+// Raise T1OUT and have Timer 1 drop it co clocks later. In
+// one-shot mode the pin takes TPOL while the timer is
+// stopped; inverting TPOL once it runs makes the pin 
+// change at the timeout and stay changed. The count and 
+// reload are loaded while the pin is still low, so only 
+// the one TPOL write, a fixed few clocks, comes between
+// the rising edge and the timer starting. A one-shot
+// times out after (reload - start) clocks, so the count
+// starts at 0 for a width of co.
+reentrant void start_pulse(uint16_t co)
+{
+	T1CTL1 = T1_ONE_SHOT;					// stopped, T1OUT low
+	T1H = 0;
+	T1L = 0;
+	T1RH = co >> 8;
+	T1RL = co;
+	T1CTL1 = T1_TPOL | T1_ONE_SHOT;			// the pulse starts
+	T1CTL1 = T1_TEN | T1_TPOL | T1_ONE_SHOT;
+	T1CTL1 = T1_TEN | T1_ONE_SHOT;			// ends at the timeout
 }
+#else
+#define start_pulse(co)			{ set_timer1_mark(co); SERVO_CP_high(); start_timer1(); }	// timer1 ISR stops the pulse
+#endif
 
 
 reentrant void outputCP()
 {
-	set_timer1_mark(CO);			// set the stop time
-	SERVO_CP_high();				// start the pulse
-	start_timer1();					// timer1 ISR stops the pulse
+	start_pulse(CO);
+	probe_pulse_start(CO);
+	LastPulseTicks = T0Ticks;
+	if (HopPending)
+	{
+		HopPending = FALSE;
+		HopTicks = T0Ticks - GoTicks;
+		if (HopTicks > HopTicksMax) HopTicksMax = HopTicks;
+	}
+}
+
+
+///////////////////////////////////////////////////////
+// Switch to the commanded channel and start its first
+// pulse in the same T0 tick, instead of spending a CO
+// period in selectCommandedChannel(). SERVO_CP is low
+// while the address lines change.
+reentrant void selectAndOutputCP()
+{
+	addressChannel(CommandedChannel);
+	ADDR_EN_high();
+	outputCP();
+}
+
+
+///////////////////////////////////////////////////////
+// Frame mode: called by isr_timer0 on every tick.
+reentrant void outputSlot()
+{
+	uint8_t i = FrameSlot;
+	uint8_t a = FrameAddressed;
+
+	if (++FrameSlot == FRAME_SLOTS)
+		FrameSlot = 0;
+
+	// the limit switch inputs belong to the channel still selected
+	if (a != SLOT_NONE)
+		FrameLimits[a] |= ~PAIN & FrameFlags[a] & (LIMIT0 | LIMIT1);
+
+	if (i >= FrameSize || !(FrameFlags[i] & SLOT_RUN) || FrameLimits[i])
+		return;
+
+	addressChannel(FrameChannel[i]);
+	ADDR_EN_high();
+	FrameAddressed = i;
+
+	start_pulse(FrameCo[i]);
+	probe_pulse_start(FrameCo[i]);
+}
+
+
+///////////////////////////////////////////////////////
+// T0Ticks can't be read in one instruction, so the main
+// loop must read it with interrupts disabled.
+uint16_t t0_ticks()
+{
+	uint16_t t;
+	DI();
+	t = T0Ticks;
+	EI();
+	return t;
+}
+
+
+///////////////////////////////////////////////////////
+// TRUE if task t has been released; it is then taken as
+// started, and its lateness recorded.
+BOOL task_due(uint8_t t)
+{
+	uint8_t bit = 1 << t;
+	uint16_t late;
+
+	if (!(TaskPending & bit)) return FALSE;
+	DI();
+	TaskPending &= ~bit;
+	late = T0Ticks - TaskReleased[t];
+	EI();
+	if (late > TaskLateMax[t]) TaskLateMax[t] = late;
+	if (late > TASK_DEADLINE[t]) ++TaskMisses[t];
+	return TRUE;
 }
 
 
@@ -511,27 +1218,149 @@ void update_CO()
 {
 	reentrant void (*t)();
 
-	if (Channel != CommandedChannel)
-		t = selectCommandedChannel;
+	if (FrameRunning)
+		t = CpEnabled ? outputSlot : doNothing;
+	else if (Channel != CommandedChannel)
+		t = (CpEnabled && (CO = Co) != 0) ? selectAndOutputCP : selectCommandedChannel;
 	else if (CpEnabled && (CO = Co) != 0)
 		t = outputCP;
 	else
 		t = doNothing;
 	
 	DI();
+	if (LimitLatched && (t == outputCP || t == selectAndOutputCP))
+		t = doNothing;					// isr_limit fired after t was chosen
 	do_CO = t;
+	FrameActive = (t == outputSlot);
 	EI();
 }
 
 
+///////////////////////////////////////////////////////
+// Stops slots that have met their own stop conditions.
+// Returns TRUE while any slot is still running.
+BOOL update_frame()
+{
+	uint8_t i;
+	BOOL running = FALSE;
+
+	for (i = 0; i < FrameSize; ++i)
+	{
+		if (!(FrameFlags[i] & SLOT_RUN))
+			continue;
+		if (FrameLimits[i] || (FrameTimeout[i] > 0 && Elapsed >= FrameTimeout[i]))
+			mask_clr(FrameFlags[i], SLOT_RUN);
+		else
+			running = TRUE;
+	}
+	return running;
+}
+
+
+///////////////////////////////////////////////////////
+// Convert adc counts to engineering units using the
+// scaled-integer gain and bias. Negative results are
+// clamped to 0.
+uint16_t calibrate(int counts, int32_t gain_q, int32_t bias_q)
+{
+	int32_t v = gain_q * counts - bias_q;
+	if (v < 0) return 0;
+	return (uint16_t)(v >> CAL_SHIFT);
+}
+
+
+///////////////////////////////////////////////////////
+// Record why and when the control pulses were stopped.
+void stopped_by(uint8_t reason)
+{
+	uint8_t code = 1;
+
+	StopReason = reason;
+	StopElapsed = Elapsed;
+	StopChannel = CommandedChannel;
+	StopPeak = MovePeak;
+	StopEventPending = TRUE;
+
+	while (reason && !(reason & 1))
+	{
+		reason >>= 1;
+		++code;
+	}
+	#ifdef _CHANNEL_TABLE
+		ChannelState[CommandedChannel].StopCode = code;
+	#endif
+	#if PROGRAM_STEPS > 0
+		if (ProgramRunning && StepStarted)
+			Program[ProgramStep].Settings.StopCode = code;
+	#endif
+}
+
+
+///////////////////////////////////////////////////////
+void stall_start()
+{
+	StallFilter = Milliamps << STALL_FILTER_SHIFT;
+	InrushPeak = 0;
+	StallIndex = 0;
+	StallSamples = 0;
+	StallDivider = 0;
+	StallSlope = 0;
+}
+
+// Called every controller update while CpEnabled. 
+// Returns TRUE if the servo has stalled.
+BOOL update_stall()
+{
+	uint16_t f, prior;
+	
+	StallFilter += Milliamps - (StallFilter >> STALL_FILTER_SHIFT);
+	f = StallFilter >> STALL_FILTER_SHIFT;
+
+	if (Elapsed <= SKIP_INRUSH)
+	{
+		if (f > InrushPeak) InrushPeak = f;
+		return FALSE;
+	}
+	
+	if (!uint8CounterReset(&StallDivider, STALL_PRESCALE - 1))
+		return FALSE;
+	
+	prior = StallHistory[StallIndex];
+	StallHistory[StallIndex] = f;
+	if (++StallIndex == STALL_WINDOW) StallIndex = 0;
+	if (StallSamples < STALL_WINDOW)
+	{
+		++StallSamples;
+		return FALSE;
+	}
+	StallSlope = f - prior;
+	
+	return StopOnStall > 0 && InrushPeak >= STALL_PEAK_MIN &&
+		StallSlope <= STALL_SLOPE_MAX && StallSlope >= -STALL_SLOPE_MAX &&
+		(uint32_t)f * 100 >= (uint32_t)InrushPeak * StopOnStall;
+}
+
+
 ///////////////////////////////////////////////////////
 void update_device()
 {
+	uint8_t reason;
+
 	// update device state
-	Limit0 = StopOnLimit0 && LIMIT0_detected();
-	Limit1 = StopOnLimit1 && LIMIT1_detected();
-	Milliamps = A1_GAIN * (AdcServoCurrent - A1_OFFSET);
-	Vps = A2_GAIN * (AdcServoVoltage - A2_OFFSET);
+	if (FrameRunning)
+	{
+		// the address lines change every slot; see update_frame()
+		Limit0 = FALSE;
+		Limit1 = FALSE;
+	}
+	else
+	{
+		Limit0 = StopOnLimit0 && (LIMIT0_detected() || (LimitLatched & LIMIT0));
+		Limit1 = StopOnLimit1 && (LIMIT1_detected() || (LimitLatched & LIMIT1));
+	}
+	Milliamps = calibrate(AdcServoCurrent, A1_GAIN_Q, A1_BIAS_Q);
+	Vps = calibrate(AdcServoVoltage, A2_GAIN_Q, A2_BIAS_Q);
+	if (CpEnabled && Milliamps > MovePeak) MovePeak = Milliamps;
 
 	// check for error conditions
 	if (Vps < V_MIN)		mask_set(Error, ERROR_LOW_POWER);
@@ -542,82 +1371,167 @@ void update_device()
 	//else					mask_clr(Error, ERROR_BOTH_LIMITS);
 	
 	// check for stop conditions
-	if 
-		(
-			(Limit0) ||
-			(Limit1) ||
-			(StopOnMilliamps > 0 && Elapsed > SKIP_INRUSH && Milliamps > StopOnMilliamps) ||
-			(StopOnTimeout > 0 && Elapsed >= StopOnTimeout)
-		)
+	reason = STOP_NONE;
+	if (Limit0) reason |= STOP_LIMIT0;
+	if (Limit1) reason |= STOP_LIMIT1;
+	if (StopOnMilliamps > 0 && Elapsed > SKIP_INRUSH && Milliamps > StopOnMilliamps)
+		reason |= STOP_CURRENT;
+	if (!FrameRunning && StopOnTimeout > 0 && Elapsed >= StopOnTimeout)
+		reason |= STOP_TIMEOUT;			// frame slots time out in update_frame()
+	if (CpEnabled && update_stall())
+		reason |= STOP_STALL;
+	if (FrameRunning && !update_frame())
+		reason |= STOP_FRAME;
+
+	if (reason)
 	{
+		if (CpEnabled) stopped_by(reason);
 		Stopped = TRUE;
 		CpEnabled = FALSE;
 	}
 	else
 		Stopped = FALSE;
 
+	#if TRACE_SIZE > 0
+		if (CpEnabled) trace_sample();
+	#endif
+
 	if (GoCommanded)
 	{
-		if (!Stopped) CpEnabled = TRUE;
+		MovePeak = 0;
+		if (!Stopped)
+		{
+			CpEnabled = TRUE;
+			trace_start();
+			stall_start();
+		}
+		else
+			stopped_by(reason);
 		GoCommanded = FALSE;
 	}	
 }
 
+
+///////////////////////////////////////////////////////
+#if TRACE_SIZE > 0
+void trace_start()
+{
+	TraceCount = 0;
+	TraceFine = 0;
+	TraceDivider = 0;
+	TraceStart = TraceLast = Milliamps;
+}
+
+// Each sample is a delta from the last, or, if it doesn't 
+// fit in -127..127, TRACE_ESCAPE and then Milliamps itself,
+// high byte first. The trace ends when a sample won't fit.
+void trace_sample()
+{
+	int d;
+	uint8_t reset = TRACE_PRESCALE - 1;
+
+	if (Elapsed > SKIP_INRUSH)
+		reset = TRACE_PRESCALE * TRACE_DECIMATE - 1;
+	if (TraceCount >= TRACE_SIZE || !uint8CounterReset(&TraceDivider, reset))
+		return;
+
+	d = Milliamps - TraceLast;
+	if (d >= -127 && d <= 127)
+		Trace[TraceCount++] = d;
+	else if (TraceCount + 3 <= TRACE_SIZE)
+	{
+		Trace[TraceCount++] = TRACE_ESCAPE;
+		Trace[TraceCount++] = Milliamps >> 8;
+		Trace[TraceCount++] = Milliamps;
+	}
+	else
+	{
+		TraceCount = TRACE_SIZE;
+		return;
+	}
+	TraceLast = Milliamps;
+	if (Elapsed <= SKIP_INRUSH)
+		++TraceFine;
+}
+#else
+void trace_start() {}
+void trace_sample() {}
+#endif
+
 ///////////////////////////////////////////////////////
+// Take any blocks isr_adc has finished.
 void check_adc()
 {
-	static uint8_t achIndex;
-	
-	int prior_adc_in = AdcIn;
-	int stabilityTest;
-	static uint8_t stabilityCounter;
-	
-	if (AdcdSettling) return;	
-	AdcIn = ADCD;
-	
-	if (ADCD_VALID(AdcIn))
-	{		
-		AdcIn = (AdcIn >> 3) - ADC_OFFSET;	// ? AdcIn = (AdcIn >> 3) + ADC_OFFSET;
-		stabilityTest = AdcIn - prior_adc_in;
-		if (stabilityTest < 0) stabilityTest = -stabilityTest;
+	uint8_t i, ready, bit;
 
-		if (stabilityTest > ADC_DELTA_LIMIT)	// significantly different
-		{
-			stabilityCounter = 0;
-		}
-		else
+	if (!task_due(TASK_ADC)) return;
+	DI();
+	ready = AdcBlockReady;
+	AdcBlockReady = 0;
+	for (i = 0, bit = 1; i < ANALOG_INPUTS; ++i, bit <<= 1)
+	{
+		if (ready & bit)
 		{
-			++stabilityCounter;
-			++StabilityMeter;
+			Ain[i] = AdcBlockAin[i];
+			AinNoise[i] = AdcBlockNoise[i];
 		}
-		
-		if (stabilityCounter < ADC_STABLE)		// unstable
-			return;								// take another reading
-		stabilityCounter = 0;
-	}	
-	else
-		AdcIn = ADC_OUTOFRANGE;
-	
-	Ain[achIndex] = AdcIn;
-	uint8CounterReset(&achIndex, ANALOG_INPUTS-1);
-	ADC_SELECT(Ach[achIndex]);
-	adc_reset();
+	}
+	EI();
 }
 
 
 ///////////////////////////////////////////////////////
 void update_controller()
 {
+	stage_begin(STAGE_ADC);
 	check_adc();
-	if (EnableControllerUpdate)
+	stage_end(STAGE_ADC);
+	if (task_due(TASK_CU))				// re-released by isr_timer0
 	{
-		EnableControllerUpdate = FALSE;	// re-enabled later by isr_timer0
-
+		stage_begin(STAGE_DEVICE);
 		update_device();
+		stage_end(STAGE_DEVICE);
+		#if PROGRAM_STEPS > 0
+			update_program();
+		#endif
+		stage_begin(STAGE_CO);
 		update_CO();
+		stage_end(STAGE_CO);
 	}	
 }
 
+// A scheduling point for long main loop work: runs a 
+// released controller update now, instead of after the
+// work is done.
+void task_yield()
+{
+	if (TaskPending & (1 << TASK_CU))
+		update_controller();
+}
+
+
+#ifdef _REPLY_SEQ
+///////////////////////////////////////////////////////
+// Reply sequence numbers
+// uart.c's endMessage() already follows each reply with
+// its CRC code and ETX, as every message has them (see
+// "Servo Controller comm protocol" and "CRC Notes for Aeon
+// serial communications"), so a host can tell a corrupted
+// reply. reply_end() adds
+//		"#SS"
+// before them, SS being ReplySeq, counting replies from 00
+// to FF and over again, so it can tell a lost one too.
+
+void reply_end()
+{
+	putch('#');
+	printhex(ReplySeq++);
+	(endMessage)();
+}
+
+#define endMessage()			reply_end()
+#endif
+
 
 ///////////////////////////////////////////////////////
 void report_header()
@@ -627,151 +1541,1346 @@ void report_header()
 }
 
 
-////////////////////////////////////////////////////////
-void report_device()
+///////////////////////////////////////////////////////
+// Acknowledge a sequence number.
+// A message may hold many commands, so a host can pipeline a
+// batch of commands and end it with 'a[n]' (and, with 
+// _REPLY_SEQ, tell if a reply was lost). The reply echoes n
+// with the Error state after the preceding commands, and with
+// ERROR_COMMAND if any of the commands since the last 'a' 
+// failed, even if later ones succeeded, or ERROR_BUF_OVFL if
+// input was lost:
+//		"A##### #####"
+void report_ack(int seq)
 {
-	printi(Channel, 3, ' '); printSpace();
-	printi(Cpw, 5, ' '); printSpace();
-	printi(CpEnabled, 1, ' '); printSpace();
-	printi(StopOnLimit0, 1, ' ');
-	printi(Limit0, 1, ' '); printSpace();
-	printi(StopOnLimit1, 1, ' ');
-	printi(Limit1, 1, ' '); printSpace();
-	printi(StopOnMilliamps, 4, ' '); printSpace();
-	printi(Milliamps, 4, ' '); printSpace();
-	printdec(StopOnTimeout, 6, ' ', 2); printSpace();
-	printdec(Elapsed, 6, ' ', 2); printSpace();
-	printdec(Vps, 6, ' ', 3); printSpace();
-	printi(Error, 5, ' ');
+	printromstr(R"A"); printi(seq, 5, ' '); printSpace();
+	printi(Error | AckErrors, 5, ' ');
 	endMessage();
+	AckErrors = 0;
 }
 
-void setCpw(int cpw)
+
+///////////////////////////////////////////////////////
+// One line per slot:
+//		"### ##### # ## ##"
+// (channel, Cpw, running, StopOnLimit0 & Limit0, 
+// StopOnLimit1 & Limit1)
+void report_frame()
 {
-	Cpw = cpw;
-	Co = (float)cpw  * (T1_FREQ / 1000000.0);
+	uint8_t i;
+	uint8_t f, l;
+	
+	for (i = 0; i < FrameSize; ++i)
+	{
+		f = FrameFlags[i];
+		l = FrameLimits[i];
+		if (i) endLine();
+		printi(FrameChannel[i], 3, ' '); printSpace();
+		printi(FrameCpw[i], 5, ' '); printSpace();
+		printi((f & SLOT_RUN) != 0, 1, ' '); printSpace();
+		printi((f & SLOT_STOP_ON_LIMIT0) != 0, 1, ' ');
+		printi((l & LIMIT0) != 0, 1, ' '); printSpace();
+		printi((f & SLOT_STOP_ON_LIMIT1) != 0, 1, ' ');
+		printi((l & LIMIT1) != 0, 1, ' ');
+	}
+	endMessage();
 }
 
-void Stop()
-{
-	CpEnabled = FALSE;
-	GoCommanded = FALSE;
+
+///////////////////////////////////////////////////////
+void printhex(uint8_t b)
+{
+	putch(HEX_DIGITS[b >> 4]);
+	putch(HEX_DIGITS[b & 0x0F]);
+}
+
+void printhex16(uint16_t w)
+{
+	printhex(w >> 8);
+	printhex(w);
+}
+
+
+///////////////////////////////////////////////////////
+// Print n right-justified in width characters, padded 
+// with pad, with a decimal point ahead of the last
+// decimals (0..4) digits. The eZ8 has no divide
+// instruction, so the digits are found by subtracting 
+// powers of ten (at most 45 subtractions) instead of 
+// printdec()'s repeated division.
+void printudec(uint16_t n, uint8_t width, char pad, uint8_t decimals)
+{
+	char d[5];
+	uint8_t i, first, len;
+	uint16_t p;
+
+	first = 5;
+	for (i = 0; i < 5; ++i)
+	{
+		p = POWERS_OF_TEN[i];
+		d[i] = '0';
+		while (n >= p)
+		{
+			n -= p;
+			++d[i];
+		}
+		if (first == 5 && d[i] != '0') first = i;
+	}
+	if (first > 4 - decimals) first = 4 - decimals;	// at least one digit before the point
+
+	len = 5 - first;
+	if (decimals) ++len;
+	for (; width > len; --width)
+		putch(pad);
+
+	for (i = first; i < 5; ++i)
+	{
+		if (decimals && i == 5 - decimals) putch('.');
+		putch(d[i]);
+	}
+}
+
+
+
+///////////////////////////////////////////////////////
+// Dump the servo current trace:
+//		"M### ##### ###"
+// (bytes recorded, starting Milliamps, samples taken before
+// TRACE_DECIMATE applied) followed by the bytes, two hex
+// digits each, 32 per line: an int8_t Milliamps delta, or
+// 80 (TRACE_ESCAPE) and then Milliamps in the next two.
+// A 3-byte sample may be split across lines.
+void report_trace()
+{
+	#if TRACE_SIZE > 0
+		uint8_t i;
+	#endif
+
+	printromstr(R"M");
+	#if TRACE_SIZE > 0
+		printi(TraceCount, 3, ' '); printSpace();
+		printi(TraceStart, 5, ' '); printSpace();
+		printi(TraceFine, 3, ' ');
+		for (i = 0; i < TraceCount; ++i)
+		{
+			if ((i & 0x1F) == 0)
+			{
+				endLine();
+				task_yield();
+			}
+			printhex(Trace[i]);
+		}
+	#else
+		printi(0, 3, ' '); printSpace();
+		printi(0, 5, ' '); printSpace();
+		printi(0, 3, ' ');
+	#endif
+	endMessage();
+}
+
+
+///////////////////////////////////////////////////////
+// One line per analog input:
+//		"ANA# ###### ##### #####"
+// (adc channel, Ain, Ain updates per second, 
+// peak-to-peak noise in adc counts)
+// Ain is in 1/2^ADC_FRACTION_BITS adc counts. The rate is
+// averaged since the previous 'd' report.
+void report_adc()
+{
+	uint8_t i;
+	uint16_t ticks = t0_ticks() - AdcStatsTicks;
+	
+	for (i = 0; i < ANALOG_INPUTS; ++i)
+	{
+		if (i) endLine();
+		printromstr(R"ANA"); printi(Ach[i], 1, ' '); printSpace();
+		printi(Ain[i], 6, ' '); printSpace();
+		printi(ticks ? (uint16_t)((uint32_t)AinBlocks[i] * T0_FREQ / ticks) : 0, 5, ' '); printSpace();
+		printi(AinNoise[i], 5, ' ');
+		DI();
+		AinBlocks[i] = 0;
+		EI();
+	}
+	AdcStatsTicks += ticks;
+	endMessage();
+}
+
+
+///////////////////////////////////////////////////////
+// The last limit switch stop:
+//		"L# #####"
+// (LIMIT0 (2) and/or LIMIT1 (1) edges latched by isr_limit,
+// T0 ticks from the start of the last pulse to the edge)
+void report_limit()
+{
+	printromstr(R"L"); printi(LimitLatched, 1, ' '); printSpace();
+	printi(LimitLatency, 5, ' ');
+	endMessage();
+}
+
+
+///////////////////////////////////////////////////////
+// Stall detection and the most recent stop:
+//		"J### #### #### ##### ### ###.##"
+// (StopOnStall, InrushPeak, filtered milliamps, 
+// StallSlope, StopReason, StopElapsed)
+void report_stall()
+{
+	printromstr(R"J"); printi(StopOnStall, 3, ' '); printSpace();
+	printi(InrushPeak, 4, ' '); printSpace();
+	printi(StallFilter >> STALL_FILTER_SHIFT, 4, ' '); printSpace();
+	printi(StallSlope, 5, ' '); printSpace();
+	printi(StopReason, 3, ' '); printSpace();
+	printdec(StopElapsed, 6, ' ', 2);
+	endMessage();
+}
+
+
+///////////////////////////////////////////////////////
+void save_settings(far CHANNEL_STATE *s)
+{
+	s->Cpw = Cpw;
+	s->StopOnLimit0 = StopOnLimit0;
+	s->StopOnLimit1 = StopOnLimit1;
+	s->StopOnTimeout = StopOnTimeout;
+	s->StopOnMilliamps = StopOnMilliamps;
+}
+
+void load_settings(far CHANNEL_STATE *s)
+{
+	setCpw(s->Cpw);
+	StopOnLimit0 = s->StopOnLimit0;
+	StopOnLimit1 = s->StopOnLimit1;
+	StopOnTimeout = s->StopOnTimeout;
+	StopOnMilliamps = s->StopOnMilliamps;
+}
+
+
+///////////////////////////////////////////////////////
+#ifdef _CHANNEL_TABLE
+// While a program step runs, the globals hold the step's
+// settings, which mustn't replace the channel's own.
+void save_channel(uint8_t ch)
+{
+	#if PROGRAM_STEPS > 0
+		if (StepSettings) return;
+	#endif
+	save_settings(&ChannelState[ch]);
+}
+
+void load_channel(uint8_t ch)
+{
+	load_settings(&ChannelState[ch]);
+}
+
+// A channel's stored settings:
+//		"K## ##### ## #### ###.## #"
+// (channel, Cpw, StopOnLimit0 & StopOnLimit1, 
+// StopOnMilliamps, StopOnTimeout, StopCode)
+void report_channel(uint8_t ch)
+{
+	far CHANNEL_STATE *s;
+	
+	if (ch == CommandedChannel) save_channel(ch);
+	s = &ChannelState[ch];
+	printromstr(R"K"); printi(ch, 2, ' '); printSpace();
+	printi(s->Cpw, 5, ' '); printSpace();
+	printi(s->StopOnLimit0, 1, ' ');
+	printi(s->StopOnLimit1, 1, ' '); printSpace();
+	printi(s->StopOnMilliamps, 4, ' '); printSpace();
+	printdec(s->StopOnTimeout, 6, ' ', 2); printSpace();
+	printi(s->StopCode, 1, ' ');
+	endMessage();
+}
+#endif
+
+
+///////////////////////////////////////////////////////
+void select_channel(uint8_t ch)
+{
+	#ifdef _CHANNEL_TABLE
+		save_channel(CommandedChannel);
+		load_channel(ch);
+	#endif
+	CommandedChannel = ch;
+}
+
+
+///////////////////////////////////////////////////////
+void go()
+{
+	DI();
+	GoTicks = T0Ticks;
+	HopPending = TRUE;
+	EI();
+	GoCommanded = TRUE;
+}
+
+
+///////////////////////////////////////////////////////
+#if PROGRAM_STEPS > 0
+// Add a step for CommandedChannel, using the present
+// Cpw, StopOnMilliamps, StopOnTimeout, and StopOnLimit
+// settings. "qa1" makes it a WaitForStop step.
+void program_add()
+{
+	far PROGRAM_STEP *p;
+	uint8_t wait;
+
+	if (ProgramSize >= PROGRAM_STEPS)
+	{
+		mask_set(Error, ERROR_PROGRAM);
+		return;
+	}
+	wait = TryInput(0, 1, ERROR_COMMAND, 0, 0);
+	if (Error & ERROR_COMMAND) return;
+	mask_clr(Error, ERROR_PROGRAM);
+	p = &Program[ProgramSize];
+	p->Channel = CommandedChannel;
+	save_settings(&p->Settings);
+	p->Settings.WaitForStop = wait;
+	p->Settings.StopCode = 0;
+	++ProgramSize;
+}
+
+// The channel's own settings come back once the 
+// program is over.
+void program_end()
+{
+	ProgramRunning = FALSE;
+	if (StepSettings)
+	{
+		StepSettings = FALSE;
+		#ifdef _CHANNEL_TABLE
+			load_channel(CommandedChannel);
+		#endif
+	}
+}
+
+void program_start()
+{
+	uint8_t i;
+	
+	for (i = 0; i < ProgramSize; ++i)
+		Program[i].Settings.StopCode = 0;
+	ProgramStep = 0;
+	StepStarted = FALSE;
+	ProgramRunning = TRUE;
+}
+
+// Called every controller update, after update_device().
+// Starts the next step once the present one has stopped.
+void update_program()
+{
+	far PROGRAM_STEP *p;
+
+	if (!ProgramRunning || GoCommanded || CpEnabled)
+		return;
+	
+	if (StepStarted)
+	{
+		StepStarted = FALSE;
+		p = &Program[ProgramStep];
+		if (p->Settings.WaitForStop && p->Settings.StopCode == STOP_CODE_TIMEOUT)
+		{
+			mask_set(Error, ERROR_PROGRAM);
+			program_end();
+			return;
+		}
+		++ProgramStep;
+	}
+	if (ProgramStep >= ProgramSize)
+	{
+		program_end();
+		return;
+	}
+	
+	p = &Program[ProgramStep];
+	Clear();
+	select_channel(p->Channel);
+	load_settings(&p->Settings);	// not saved to the channel
+	StepSettings = TRUE;
+	StepStarted = TRUE;
+	go();
+}
+
+// Program status:
+//		"Q# ## ## ########"
+// (running, step in progress, number of steps, and each 
+// step's StopCode, one digit per step)
+void report_program()
+{
+	uint8_t i;
+	
+	printromstr(R"Q"); printi(ProgramRunning, 1, ' '); printSpace();
+	printi(ProgramStep, 2, ' '); printSpace();
+	printi(ProgramSize, 2, ' '); printSpace();
+	for (i = 0; i < ProgramSize; ++i)
+		printi(Program[i].Settings.StopCode, 1, ' ');
+	endMessage();
+}
+#endif
+
+
+///////////////////////////////////////////////////////
+// Timing:
+//		"W##### #####"
+// (T0 ticks from the last 'go' to its first pulse, and the 
+// worst case since the last "wr")
+void report_timing()
+{
+	printromstr(R"W"); printi(HopTicks, 5, ' '); printSpace();
+	printi(HopTicksMax, 5, ' ');
+	endMessage();
+}
+
+
+///////////////////////////////////////////////////////
+// Main loop tasks, one line each:
+//		"T# ##### ##### #####"
+// (task, skipped releases, missed deadlines, and the 
+// worst start delay in T0 ticks, since the last "wr")
+void report_tasks()
+{
+	uint8_t t;
+
+	for (t = 0; t < TASKS; ++t)
+	{
+		if (t) endLine();
+		printromstr(R"T"); printudec(t, 1, ' ', 0); printSpace();
+		printudec(TaskSkips[t], 5, ' ', 0); printSpace();
+		printudec(TaskMisses[t], 5, ' ', 0); printSpace();
+		printudec(TaskLateMax[t], 5, ' ', 0);
+	}
+	endMessage();
+}
+
+void reset_tasks()
+{
+	uint8_t t;
+
+	for (t = 0; t < TASKS; ++t)
+	{
+		DI();
+		TaskSkips[t] = 0;
+		EI();
+		TaskMisses[t] = 0;
+		TaskLateMax[t] = 0;
+	}
+}
+
+
+///////////////////////////////////////////////////////
+#ifdef _ISR_PROBES
+// ISR timing probes, one line each:
+//		"P# ###### ###### ###### ##### ##### ... #####"
+// (probe, min, max, mean, samples, and the PROBE_BINS
+// log2 histogram counts, since the last "wr")
+void report_probes()
+{
+	PROBE s;
+	uint8_t p, b;
+
+	for (p = 0; p < PROBES; ++p)
+	{
+		DI();
+		s = Probe[p];
+		EI();
+
+		if (p) endLine();
+		printromstr(R"P"); printudec(p, 1, ' ', 0); printSpace();
+		printi(s.Count ? s.Min : 0, 6, ' '); printSpace();
+		printi(s.Count ? s.Max : 0, 6, ' '); printSpace();
+		printi(s.Count ? (int)(s.Sum / s.Count) : 0, 6, ' '); printSpace();
+		printudec(s.Count, 5, ' ', 0);
+		for (b = 0; b < PROBE_BINS; ++b)
+		{
+			printSpace(); printudec(s.Bins[b], 5, ' ', 0);
+		}
+	}
+	endMessage();
+}
+
+void reset_probes()
+{
+	far PROBE *s;
+	uint8_t p, b;
+
+	for (p = 0; p < PROBES; ++p)
+	{
+		s = &Probe[p];
+		DI();
+		s->Min = 32767;
+		s->Max = -32767;
+		s->Sum = 0;
+		s->Count = 0;
+		for (b = 0; b < PROBE_BINS; ++b)
+			s->Bins[b] = 0;
+		EI();
+	}
+	DI();
+	mask_clr(Error, ERROR_TIMING);
+	EI();
+}
+#else
+void report_probes()
+{
+	mask_set(Error, ERROR_COMMAND);
+}
+
+void reset_probes() {}
+#endif
+
+
+///////////////////////////////////////////////////////
+#ifdef _STAGE_PROFILE
+// Main loop stages, one line each:
+//		"S# ##### ##### #####"
+// (stage, calls, mean and longest T0 clocks, since the 
+// last "wr")
+void report_stages()
+{
+	uint8_t s;
+	uint32_t mean;
+
+	for (s = 0; s < STAGES; ++s)
+	{
+		mean = StageCalls[s] ? StageClocks[s] / StageCalls[s] : 0;
+		if (mean > 0xFFFF) mean = 0xFFFF;
+		if (s) endLine();
+		printromstr(R"S"); printudec(s, 1, ' ', 0); printSpace();
+		printudec(StageCalls[s], 5, ' ', 0); printSpace();
+		printudec(mean, 5, ' ', 0); printSpace();
+		printudec(StageMax[s], 5, ' ', 0);
+	}
+	endMessage();
+}
+
+void reset_stages()
+{
+	uint8_t s;
+
+	for (s = 0; s < STAGES; ++s)
+	{
+		StageCalls[s] = 0;
+		StageClocks[s] = 0;
+		StageMax[s] = 0;
+	}
+}
+#else
+void report_stages()
+{
+	mask_set(Error, ERROR_COMMAND);
+}
+
+void reset_stages() {}
+#endif
+
+
+///////////////////////////////////////////////////////
+// Receive overruns:
+//		"O##### ###"
+// (since the last "or": with _RX_PARSER, the commands lost
+// and the most RxQueue held; otherwise, the main loop 
+// passes that found ERROR_BUF_OVFL, and the most commands
+// one of them found waiting)
+void report_overruns()
+{
+	printromstr(R"O"); printudec(RxOverruns, 5, ' ', 0); printSpace();
+	#ifdef _RX_PARSER
+		printudec(RxDepthMax, 3, ' ', 0);
+	#else
+		printudec(RxBurstMax, 3, ' ', 0);
+	#endif
+	endMessage();
+}
+
+
+///////////////////////////////////////////////////////
+// The most recent stop:
+//		"E### ### ###.## ####"
+// (channel, StopReason, StopElapsed, peak milliamps)
+// Sent unsolicited when events are enabled ("e1").
+void report_event()
+{
+	printromstr(R"E"); printi(StopChannel, 3, ' '); printSpace();
+	printi(StopReason, 3, ' '); printSpace();
+	printdec(StopElapsed, 6, ' ', 2); printSpace();
+	printi(StopPeak, 4, ' ');
+	endMessage();
+}
+
+
+///////////////////////////////////////////////////////
+// Baud rate, in hundreds:
+//		"U####"
+void report_baud()
+{
+	printromstr(R"U"); printudec(BAUD_HUNDREDS[BaudRate], 4, ' ', 0);
+	endMessage();
+}
+
+void set_baud(uint8_t i)
+{
+	BaudRate = i;
+	U0BRH = 0;
+	U0BRL = BAUD_BRG[i];
+}
+
+// TRUE if the UART has sent everything given to it
+BOOL tx_drained()
+{
+	uint8_t n;
+
+	for (n = 0; n < TX_IDLE_POLLS; ++n)
+		if (!(U0STAT0 & U0_TXE)) return FALSE;
+	return TRUE;
+}
+
+// Called every do_commands(), to switch to a pending
+// rate once the acknowledgement has been sent, and to
+// fall back if nothing valid arrives at the new rate.
+void update_baud()
+{
+	if (BaudPending < BAUD_RATES)
+	{
+		if (!tx_drained()) return;
+		set_baud(BaudPending);
+		BaudPending = BAUD_RATES;
+		BaudTrial = (BaudRate != BAUD_FALLBACK);
+		BaudTicks = t0_ticks();
+		mask_clr(Error, ERROR_CRC);		// only errors at the new rate count
+	}
+	else if (BaudTrial && t0_ticks() - BaudTicks >= BAUD_TRIAL * T0_FREQ)
+	{
+		set_baud(BAUD_FALLBACK);
+		BaudTrial = FALSE;
+	}
+}
+
+
+////////////////////////////////////////////////////////
+void report_device()
+{
+	stage_begin(STAGE_REPORT);
+	printudec(Channel, 3, ' ', 0); printSpace();
+	printudec(Cpw, 5, ' ', 0); printSpace();
+	printudec(CpEnabled, 1, ' ', 0); printSpace();
+	printudec(StopOnLimit0, 1, ' ', 0);
+	printudec(Limit0, 1, ' ', 0); printSpace();
+	printudec(StopOnLimit1, 1, ' ', 0);
+	printudec(Limit1, 1, ' ', 0); printSpace();
+	printudec(StopOnMilliamps, 4, ' ', 0); printSpace();
+	printudec(Milliamps, 4, ' ', 0); printSpace();
+	printudec(StopOnTimeout, 6, ' ', 2); printSpace();
+	printudec(Elapsed, 6, ' ', 2); printSpace();
+	printudec(Vps, 6, ' ', 3); printSpace();
+	printudec(Error, 5, ' ', 0);
+	endMessage();
+	stage_end(STAGE_REPORT);
+}
+
+///////////////////////////////////////////////////////
+// report_device() in BINARY_REPORT_SIZE bytes, after a
+// 'B' and a byte giving their number. ETX may not appear
+// in a message but as its end, so an ETX or BINARY_ESCAPE
+// byte is sent as BINARY_ESCAPE and the byte XOR 0x20; the
+// count is of the bytes before escaping. Most significant
+// first:
+//		Channel (1), Cpw (2), flags (1), StopOnMilliamps (2), 
+//		Milliamps (2), StopOnTimeout (2), Elapsed (2), 
+//		Vps (2), Error (2)
+// flags bits: 0 CpEnabled, 1 StopOnLimit0, 2 Limit0,
+// 3 StopOnLimit1, 4 Limit1
+#define BINARY_REPORT_SIZE		16
+#define BINARY_ESCAPE			0x7D
+
+void putch8(uint8_t b)
+{
+	if (b == 0x03 || b == BINARY_ESCAPE)
+	{
+		putch(BINARY_ESCAPE);
+		b ^= 0x20;
+	}
+	putch(b);
+}
+
+void putch16(uint16_t w)
+{
+	putch8(w >> 8);
+	putch8(w);
+}
+
+void report_binary()
+{
+	uint8_t flags = 0;
+
+	if (CpEnabled)		flags |= 0x01;
+	if (StopOnLimit0)	flags |= 0x02;
+	if (Limit0)			flags |= 0x04;
+	if (StopOnLimit1)	flags |= 0x08;
+	if (Limit1)			flags |= 0x10;
+
+	putch('B');
+	putch(BINARY_REPORT_SIZE);
+	putch8(Channel);
+	putch16(Cpw);
+	putch8(flags);
+	putch16(StopOnMilliamps);
+	putch16(Milliamps);
+	putch16(StopOnTimeout);
+	putch16(Elapsed);
+	putch16(Vps);
+	putch16(Error);
+	endMessage();
+}
+
+void report_status()
+{
+	if (BinaryReports)
+		report_binary();
+	else
+		report_device();
+}
+
+void setCpw(int cpw)
+{
+	Cpw = cpw;
+	Co = ((uint32_t)cpw * CO_PER_US_Q) >> CO_Q;
+}
+
+void Stop()
+{
+	if (CpEnabled) stopped_by(STOP_COMMAND);
+	CpEnabled = FALSE;
+	GoCommanded = FALSE;
+	FrameRunning = FALSE;
+	#if PROGRAM_STEPS > 0
+		program_end();
+	#endif
+}
+
+///////////////////////////////////////////////////////
+// Add a slot for CommandedChannel, using the present
+// Cpw, StopOnTimeout, and StopOnLimit settings.
+void frame_add()
+{
+	uint8_t i = FrameSize;
+	
+	if (i >= FRAME_SLOTS || Co > SLOT_CO_MAX)
+	{
+		mask_set(Error, ERROR_FRAME);
+		return;
+	}
+	mask_clr(Error, ERROR_FRAME);
+
+	FrameChannel[i] = CommandedChannel;
+	FrameCpw[i] = Cpw;
+	FrameCo[i] = Co;
+	FrameTimeout[i] = StopOnTimeout;
+	FrameFlags[i] = 0;
+	if (StopOnLimit0) mask_set(FrameFlags[i], SLOT_STOP_ON_LIMIT0);
+	if (StopOnLimit1) mask_set(FrameFlags[i], SLOT_STOP_ON_LIMIT1);
+	FrameSize = i + 1;
+}
+
+void frame_start()
+{
+	uint8_t i;
+	
+	for (i = 0; i < FrameSize; ++i)
+	{
+		mask_set(FrameFlags[i], SLOT_RUN);
+		FrameLimits[i] = 0;
+	}
+	FrameSlot = 0;
+	FrameAddressed = SLOT_NONE;
+	FrameRunning = TRUE;
+}
+
+void Clear()
+{
+	Milliamps = 0;
+	Elapsed = 0.0;
+	LimitLatched = 0;
+}
+
+#ifdef _RX_PARSER
+///////////////////////////////////////////////////////
+// Receive-interrupt command parser
+// A message holds commands separated by whitespace, then
+// its CRC code and ETX. A command is its letters (only the
+// first two are kept), then an optional argument: '-', 
+// digits, '.', digits; anything else makes the rest of the
+// command ignored. "0" alone is the reset-to-center
+// command. Each character is parsed once the two after it
+// show it isn't part of the CRC code. The commands are 
+// queued for do_commands() once the message's CRC proves
+// good; otherwise they're dropped, with ERROR_CRC, or with
+// ERROR_BUF_OVFL if a character was lost. As in the CRC 
+// notes' rxByte(), an ETX with a bad CRC may be a byte of
+// the CRC code, so the message runs on; once more than two
+// bytes follow it, the message (and the next, which it has
+// taken in) is dropped. A message may 
+// hold up to RX_QUEUE - 1 commands; one that doesn't fit
+// in the queue is dropped with ERROR_BUF_OVFL. -RTS is 
+// raised once RX_RTS_DEPTH commands are waiting; 
+// do_commands() lowers it when it has taken them.
+
+// A command was lost
+void rx_overrun()
+{
+	if (RxOverruns != 0xFFFF) ++RxOverruns;
+	mask_set(Error, ERROR_BUF_OVFL);
+}
+
+void rx_clear(far RX_COMMAND *r)
+{
+	r->Letters[0] = r->Letters[1] = '\0';
+	r->Flags = 0;
+	r->Digits = 0;
+}
+
+// Drop any commands of the message being received, and
+// start the next
+void rx_start()
+{
+	RxQueueFill = RxQueueHead;
+	rx_clear(&RxQueue[RxQueueFill]);
+	RxCrc = RX_CRC_INIT;
+	RxFrame.Held = 0;
+	RxFrame.EtxAge = 0;
+	RxFrame.Bad = FALSE;
+}
+
+// Move on from a complete command
+void rx_end_command()
+{
+	far RX_COMMAND *r = &RxQueue[RxQueueFill];
+	uint8_t next;
+
+	if (!r->Letters[0] && !(r->Flags & RX_ARG))
+	{
+		rx_clear(r);					// nothing to do
+		return;
+	}
+	next = RxQueueFill + 1;
+	if (next == RX_QUEUE) next = 0;
+	if (next == RxQueueTail)
+		rx_overrun();
+	else
+		RxQueueFill = next;
+	rx_clear(&RxQueue[RxQueueFill]);
 }
 
-void Clear()
-{
-	Milliamps = 0;
-	Elapsed = 0.0;
+void rx_parse(char c)
+{
+	far RX_COMMAND *r = &RxQueue[RxQueueFill];
+
+	if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+		rx_end_command();
+	else if (r->Flags & RX_SKIP)
+		;
+	else if (c >= '0' && c <= '9')
+	{
+		if (r->Flags & RX_POINT)
+		{
+			if ((r->Flags & RX_FRAC) == RX_FRAC_MAX) return;
+			++r->Flags;						// RX_FRAC
+		}
+		if (r->Digits > RX_DIGITS_MAX)
+			r->Flags |= RX_OVER;
+		else
+			r->Digits = r->Digits * 10 + (c - '0');
+		r->Flags |= RX_ARG;
+	}
+	else if (c == '.' && !(r->Flags & RX_POINT))
+		r->Flags |= RX_POINT;
+	else if (c == '-' && !(r->Flags & (RX_ARG | RX_POINT | RX_NEGATIVE)))
+		r->Flags |= RX_NEGATIVE;
+	else if (!(r->Flags & (RX_ARG | RX_POINT | RX_NEGATIVE)) &&
+		(c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+	{
+		if (!r->Letters[0])
+			r->Letters[0] = c | 0x20;		// lower case
+		else if (!r->Letters[1])
+			r->Letters[1] = c | 0x20;
+	}
+	else
+		r->Flags |= RX_SKIP;
+}
+
+// As the protocol notes' rxByte(): an ETX ends the message
+// if the CRC is good; any other is taken to be in the CRC 
+// code, and the message is bad if more than two characters
+// follow it.
+void interrupt isr_rx()
+{
+	uint8_t status = U0STAT0;
+	char c = U0RXD;
+	uint8_t depth;
+
+	if ((status & U0_OE) && !RxFrame.Bad)	// a character was lost
+	{
+		rx_overrun();
+		RxFrame.Bad = TRUE;
+	}
+	if (RxFrame.EtxAge && RxFrame.EtxAge < 3) ++RxFrame.EtxAge;
+
+	if (c == RX_ETX)
+	{
+		if (RxCrc == RX_CRC_GOOD && !RxFrame.Bad)
+		{
+			rx_end_command();			// RxHeld is the CRC code
+			RxQueueHead = RxQueueFill;
+			depth = RxQueueHead >= RxQueueTail ? RxQueueHead - RxQueueTail : RxQueueHead + RX_QUEUE - RxQueueTail;
+			if (depth > RxDepthMax) RxDepthMax = depth;
+			if (depth >= RX_RTS_DEPTH) RX_busy();
+		}
+		else if (!RxFrame.Bad && !RxFrame.EtxAge)
+			RxFrame.EtxAge = 1;
+		if (RxCrc == RX_CRC_GOOD || RxFrame.Bad)
+		{
+			rx_start();
+			return;
+		}
+	}
+
+	RxCrc = (RxCrc >> 4) ^ RX_CRC_NIBBLE[(RxCrc ^ c) & 0x0F];
+	RxCrc = (RxCrc >> 4) ^ RX_CRC_NIBBLE[(RxCrc ^ (c >> 4)) & 0x0F];
+	if (RxFrame.Held == 2)
+		rx_parse(RxHeld[0]);
+	else
+		++RxFrame.Held;
+	RxHeld[0] = RxHeld[1];
+	RxHeld[1] = c;
+
+	if (RxFrame.EtxAge == 3 && !RxFrame.Bad)
+	{
+		mask_set(Error, ERROR_CRC);
+		RxFrame.Bad = TRUE;
+	}
+}
+
+// GetInput(): take the next queued command
+void rx_take()
+{
+	RxCmd = RxQueue[RxQueueTail];
+	if (++RxQueueTail == RX_QUEUE) RxQueueTail = 0;
+	if (!RxCmd.Letters[0] && RxCmd.Digits == 0)
+		RxCmd.Letters[0] = '0';
+}
+
+// Narg: the argument's integer part
+int rx_narg()
+{
+	int n = RxCmd.Digits;
+	uint8_t frac;
+
+	for (frac = RxCmd.Flags & RX_FRAC; frac; --frac)
+		n /= 10;
+	return (RxCmd.Flags & RX_NEGATIVE) ? -n : n;
+}
+
+// TryInput(): the argument scaled by 10^decimals, or dflt
+// if absent. Sets error if it is out of [min..max].
+int rx_input(int min, int max, uint16_t error, int dflt, uint8_t decimals)
+{
+	int32_t n = RxCmd.Digits;
+	uint8_t frac = RxCmd.Flags & RX_FRAC;
+
+	mask_clr(Error, error);
+	if (!NargPresent)
+		return dflt;
+	for (; frac < decimals; ++frac)
+		n *= 10;
+	for (; frac > decimals; --frac)
+		n /= 10;
+	if (RxCmd.Flags & RX_NEGATIVE)
+		n = -n;
+	if ((RxCmd.Flags & RX_OVER) || n < min || n > max)
+	{
+		mask_set(Error, error);
+		return dflt;
+	}
+	return (int)n;
 }
+#endif
+
 
 ///////////////////////////////////////////////////////
-void do_commands()
+// Command handlers. Each is passed the sub-command
+// letter (Command[1]), if any; Narg, NargPresent, and 
+// TryInput() give the argument.
+
+void cmd_report(char c2)		// r: report
+{
+	if (c2 == 'b' || c2 == 't')	// select binary or text reports
+		BinaryReports = (c2 == 'b');
+	else if (NargPresent)		// set Datalogging interval
+	{
+		// rolls under to 0xFF (meaning "disable") if DatalogReset was 0
+		DatalogReset = TryInput(0, 255, ERROR_DATALOG, DatalogReset + 1, 0) - 1;
+		DatalogCount = 0;
+	}
+	else						// one-time report
+		report_status();
+}
+
+void cmd_stop(char c2)			// s: stop
+{
+	Stop();						// retains MilliAmps and Elapsed
+}
+
+void cmd_go(char c2)			// g: go
+{
+	Stop();
+	Clear();
+	if (NargPresent)			// it's a control pulse width
+		setCpw(TryInput(CPW_MIN, CPW_MAX, ERROR_CPW, Cpw, 0));
+	go();
+}
+
+void cmd_clear(char c2)			// c: clear
+{
+	Clear();
+}
+
+void cmd_frame(char c2)			// f: multi-servo frame
+{
+	if (c2 == 'a')				// add a slot for the commanded channel
+	{
+		frame_add();
+	}
+	else if (c2 == 'g')			// go: run all slots
+	{
+		Stop();
+		Clear();
+		frame_start();
+		GoCommanded = TRUE;
+	}
+	else if (c2 == 'c')			// clear all slots
+	{
+		Stop();
+		FrameSize = 0;
+	}
+	else if (c2 == 'r')			// report slots
+	{
+		report_frame();
+	}
+	else
+		mask_set(Error, ERROR_COMMAND);
+}
+
+void cmd_select(char c2)		// n: select channel
+{
+	int n;
+
+	Stop();
+	Clear();
+	n = TryInput(0, CHANNELS - 1, ERROR_CHANNEL, Channel, 0);
+	if (!(Error & ERROR_CHANNEL))
+		select_channel(n);
+}
+
+#if PROGRAM_STEPS > 0
+void cmd_program(char c2)		// q: move program
+{
+	if (c2 == 'a')				// add a step for the commanded channel; 1 = WaitForStop
+	{
+		program_add();
+	}
+	else if (c2 == 'g')			// go: run the program
+	{
+		Stop();
+		program_start();
+	}
+	else if (c2 == 'c')			// clear the program
+	{
+		Stop();
+		ProgramSize = 0;
+	}
+	else if (c2 == 'r' || c2 == '\0')	// report progress
+	{
+		report_program();
+	}
+	else
+		mask_set(Error, ERROR_COMMAND);
+}
+#else
+#define cmd_program				0
+#endif
+
+#ifdef _CHANNEL_TABLE
+void cmd_channel(char c2)		// k: report a channel's settings
 {
-	char c, c2;
 	int n;
 
+	n = TryInput(0, CHANNELS - 1, ERROR_CHANNEL, CommandedChannel, 0);
+	if (!(Error & ERROR_CHANNEL))
+		report_channel(n);
+}
+#else
+#define cmd_channel				0
+#endif
+
+void cmd_cpw(char c2)			// p: set control pulse width
+{
+	setCpw(TryInput(CPW_MIN, CPW_MAX, ERROR_CPW, Cpw, 0));
+}
+
+void cmd_current(char c2)		// i: set current limit
+{
+	StopOnMilliamps = TryInput(0, CURRENT_MAX, ERROR_ILIM, StopOnMilliamps, 0);
+}
+
+void cmd_stall(char c2)			// j: set stall threshold
+{
+	if (NargPresent)
+		StopOnStall = TryInput(0, 100, ERROR_STALL, StopOnStall, 0);
+	else						// report stall detection and the last stop
+		report_stall();
+}
+
+void cmd_timeout(char c2)		// t: set timeout
+{
+	StopOnTimeout = TryInput(0, TIMEOUT_MAX, ERROR_TIMEOUT, StopOnTimeout, 2);
+}
+
+void cmd_limits(char c2)		// l: (letter 'l', not number '1') set stop limits
+{
+	mask_clr(Error, ERROR_LIMSW);
+	if (!NargPresent) {			// report the last limit stop
+		report_limit();
+	} else if (Narg == 10) {	//  10 == enable limit 0
+		StopOnLimit0 = TRUE;
+	} else if (Narg == 11) {	//  11 == enable limit 1
+		StopOnLimit1 = TRUE;
+	} else if (Narg == -10) {	// -10 == disable limit 0
+		StopOnLimit0 = FALSE;
+	} else if (Narg == -11) {	// -11 == disable limit 1
+		StopOnLimit1 = FALSE;
+	} else {
+		mask_set(Error, ERROR_LIMSW);
+	}
+}
+
+void cmd_ack(char c2)			// a: acknowledge sequence number
+{
+	report_ack(NargPresent ? Narg : 0);
+}
+
+void cmd_adc(char c2)			// d: adc diagnostics
+{
+	report_adc();
+}
+
+void cmd_trace(char c2)			// m: dump servo current trace
+{
+	report_trace();
+}
+
+void cmd_timing(char c2)		// w: timing
+{
+	if (c2 == 'r')				// reset worst cases
+	{
+		HopTicksMax = 0;
+		reset_tasks();
+		reset_probes();
+		reset_stages();
+	}
+	else if (c2 == 't')			// main loop tasks
+		report_tasks();
+	else if (c2 == 'l')			// ISR latency and jitter
+		report_probes();
+	else if (c2 == 'p')			// main loop stage profile
+		report_stages();
+	else
+		report_timing();
+}
+
+void cmd_overruns(char c2)		// o: receive overruns
+{
+	if (c2 == 'r')				// reset the counters
+	{
+		#ifdef _RX_PARSER
+			DI();				// isr_rx counts
+			RxOverruns = 0;
+			RxDepthMax = 0;
+			EI();
+		#else
+			RxOverruns = 0;
+			RxBurstMax = 0;
+		#endif
+	}
+	else
+		report_overruns();
+}
+
+void cmd_baud(char c2)			// b: baud rate
+{
+	uint8_t n;
+
+	if (NargPresent)			// in hundreds; must be one of BAUD_HUNDREDS
+	{
+		for (n = 0; n < BAUD_RATES && BAUD_HUNDREDS[n] != Narg; ++n)
+			;
+		if (n < BAUD_RATES)
+			BaudPending = n;
+		else
+			mask_set(Error, ERROR_COMMAND);
+	}
+	report_baud();				// the acknowledgement, at the old rate
+}
+
+void cmd_events(char c2)		// e: stop events
+{
+	if (NargPresent)			// 1 = send each stop as it happens
+	{
+		EnableEvents = TryInput(0, 1, ERROR_COMMAND, EnableEvents, 0);
+		StopEventPending = FALSE;	// only stops from here on
+	}
+	else
+	{
+		StopEventPending = FALSE;
+		report_event();
+	}
+}
+
+void cmd_header(char c2)		// h: report header
+{
+	report_header();
+}
+
+void cmd_info(char c2)			// z: program data
+{
+	printromstr(FIRMWARE); printromstr(VERSION); endLine();
+	printromstr(R"S/N:"); printi(SERNO, 4, ' '); endLine();
+	printromstr(R"CPW_MIN:"); printi(CPW_MIN, 4, ' ');
+	printromstr(R" CPW_MAX:"); printi(CPW_MAX, 6, ' ');
+	endMessage();
+}
+
+// Indexed by command letter - 'a'; 0 = unrecognized
+typedef void (*COMMAND_HANDLER)(char);
+rom COMMAND_HANDLER COMMANDS[26] =
+{
+	cmd_ack,		// a
+	cmd_baud,		// b
+	cmd_clear,		// c
+	cmd_adc,		// d
+	cmd_events,		// e
+	cmd_frame,		// f
+	cmd_go,			// g
+	cmd_header,		// h
+	cmd_current,	// i
+	cmd_stall,		// j
+	cmd_channel,	// k
+	cmd_limits,		// l
+	cmd_trace,		// m
+	cmd_select,		// n
+	cmd_overruns,	// o
+	cmd_cpw,		// p
+	cmd_program,	// q
+	cmd_report,		// r
+	cmd_stop,		// s
+	cmd_timeout,	// t
+	0,				// u
+	0,				// v
+	cmd_timing,		// w
+	0,				// x
+	0,				// y
+	cmd_info		// z
+};
+
+
+///////////////////////////////////////////////////////
+void do_commands()
+{
+	char c;
+
+	stage_begin(STAGE_COMMANDS);
+	task_due(TASK_COMMANDS);			// for its lateness; commands are always taken
+
+	// isr_rx counts each command it loses; uart.c only sets
+	// ERROR_BUF_OVFL, so count it here, and clear it to see
+	// the next one
+	if (Error & ERROR_BUF_OVFL)
+	{
+		#ifndef _RX_PARSER
+			++RxOverruns;
+		#endif
+		DI();
+		mask_clr(Error, ERROR_BUF_OVFL);
+		EI();
+		AckErrors |= ERROR_BUF_OVFL;
+	}
+	#ifdef _RX_PARSER
+		if (Error & ERROR_CRC)			// likewise a message isr_rx dropped
+		{
+			DI();
+			mask_clr(Error, ERROR_CRC);
+			EI();
+			AckErrors |= ERROR_CRC;
+		}
+	#endif
+
+	#ifndef _RX_PARSER
+		RxBurst = 0;
+	#endif
 	while (!RxbEmpty())					// process a command
 	{
-		mask_clr(Error, ERROR_COMMAND);
 		GetInput();
+		#ifndef _RX_PARSER
+			if (++RxBurst > RxBurstMax) RxBurstMax = RxBurst;
+		#endif
 		c = Command[0];					// a command
-		c2 = Command[1];				// possibly a sub-command
+		mask_clr(Error, ERROR_COMMAND);	// AckErrors keeps it for 'a'
 		
 		// single-byte commands
 		if (c == '\0')					// null command
 		{
 			// do nothing
 		}
-		else if (c == 'r')				// report
-		{
-			if (NargPresent)			// set Datalogging interval
-			{
-				// rolls under to 0xFF (meaning "disable") if DatalogReset was 0
-				DatalogReset = TryInput(0, 255, ERROR_DATALOG, DatalogReset + 1, 0) - 1;
-				DatalogCount = 0;
-			}
-			else						// one-time report
-				report_device();
-		}
-		else if (c == 's')				// stop
-		{
-			Stop();						// retains MilliAmps and Elapsed
-		}
-		else if (c == 'g')				// go
-		{
-			Stop();
-			Clear();
-			if (NargPresent)			// it's a control pulse width
-				setCpw(TryInput(CPW_MIN, CPW_MAX, ERROR_CPW, Cpw, 0));
-			GoCommanded = TRUE;			
-		}
-		else if (c == 'c')				// clear
-		{
-			Clear();
-		}
-		else if (c == 'n')				// select channel
-		{				
-			Stop();
-			Clear();
-			n = TryInput(0, CHANNELS - 1, ERROR_CHANNEL, Channel, 0);
-			if (!(Error & ERROR_CHANNEL))
-				CommandedChannel = n;				
-		}
-		else if (c == 'p')				// set control pulse width
-		{
-			setCpw(TryInput(CPW_MIN, CPW_MAX, ERROR_CPW, Cpw, 0));
-		}
-		else if (c == 'i')				// set current limit
-		{
-			StopOnMilliamps = TryInput(0, CURRENT_MAX, ERROR_ILIM, StopOnMilliamps, 0);
-		}
-		else if (c == 't')				// set timeout				
-		{
-			StopOnTimeout = TryInput(0, TIMEOUT_MAX, ERROR_TIMEOUT, StopOnTimeout, 2);
-		}
-		else if (c == 'l')				// (letter 'l', not number '1') set stop limits
-		{
-			mask_clr(Error, ERROR_LIMSW);
-			if (Narg == 10) {			//  10 == enable limit 0
-				StopOnLimit0 = TRUE;
-			} else if (Narg == 11) {	//  11 == enable limit 1
-				StopOnLimit1 = TRUE;
-			} else if (Narg == -10) {	// -10 == disable limit 0
-				StopOnLimit0 = FALSE;
-			} else if (Narg == -11) {	// -11 == disable limit 1
-				StopOnLimit1 = FALSE;
-			} else {
-				mask_set(Error, ERROR_LIMSW);
-			}
-		}				
 		else if (c == '0')				// reset to center
 		{
 			setCpw(CPW_CTR);
 		}
-		else if (c == 'h')				// report header
+		else if (c >= 'a' && c <= 'z' && COMMANDS[c - 'a'])
 		{
-			report_header();
-		}
-		else if (c == 'z')				// program data
-		{
-			printromstr(FIRMWARE); printromstr(VERSION); endLine();
-			printromstr(R"S/N:"); printi(SERNO, 4, ' '); endLine();
-			printromstr(R"CPW_MIN:"); printi(CPW_MIN, 4, ' ');
-			printromstr(R" CPW_MAX:"); printi(CPW_MAX, 6, ' ');
-			endMessage();
+			COMMANDS[c - 'a'](Command[1]);
 		}
 		else							// unrecognized command
 		{
 			mask_set(Error, ERROR_COMMAND);
 		}
+		if (Error & ERROR_COMMAND)
+			AckErrors |= ERROR_COMMAND;
+
+		if (BaudTrial && c != '\0' && !(Error & (ERROR_COMMAND | ERROR_CRC)))
+			BaudTrial = FALSE;			// the new rate works
+		task_yield();					// don't hold up the controller for a burst
 	}
+	#ifdef _RX_FLOW_CONTROL
+		DI();							// isr_rx raises -RTS
+		if (RxbEmpty()) RX_ready();		// the host may send
+		EI();
+	#endif
+	update_baud();
 	
-	if (EnableDatalogging)
+	if (StopEventPending && EnableEvents)
+	{
+		StopEventPending = FALSE;
+		report_event();
+	}
+
+	if (task_due(TASK_DATALOG))			// re-released by isr_timer0
 	{
-		EnableDatalogging = FALSE;		// re-enabled later by isr_timer0
 		if (DatalogReset != 0xFF && uint8CounterReset(&DatalogCount, DatalogReset))
-			report_device();
+			report_status();
 	}
+	stage_end(STAGE_COMMANDS);
 }
 
 
@@ -779,39 +2888,70 @@ void do_commands()
 // 
 void interrupt isr_timer0()
 {
+	uint8_t tick;
+	#ifdef _ISR_PROBES
+	uint16_t latency = t0_count() - 1;	// the count restarts at 1; binned after do_CO
+	#endif
+
 	++T0Ticks;	
+	tick = T0_SCHEDULE[T0Phase];
+	if (++T0Phase >= T0_SCHEDULE_TICKS) T0Phase = 0;
 
-	#if CO_PERIOD > 1
-		if (CO_INTERVAL)
-	#endif
-		 {
-			stop_timer1();
-			IRQ_CLEAR_T1();
-			EI();
-			do_CO();
-		 }
-	#if CO_PERIOD > 1
-		 else
-			EI(); 
+	if ((tick & TICK_CO) || FrameActive)
+	{
+		stop_timer1();
+		IRQ_CLEAR_T1();
+		EI();
+		do_CO();
+	}
+	else
+		EI(); 
+
+	#ifdef _ISR_PROBES
+		probe_sample(PROBE_T0, latency);
+		if (latency > CO_MAX_RESERVE) mask_set(Error, ERROR_TIMING);
 	#endif
 	
-	#if SERVICE_PERIOD > 1
-		if (SERVICE_INTERVAL)
-	#endif
-		{
-			if (CpEnabled)
-				Elapsed = (Elapsed + 1) & ELAPSED_RESET;
-		}
+	if (tick & TICK_SERVICE)
+	{
+		if (CpEnabled)
+			Elapsed = (Elapsed + 1) & ELAPSED_RESET;
+	}
 
-	#if CU_PERIOD > 1
-		if (CU_INTERVAL)
-	#endif
-		{
-			EnableControllerUpdate = TRUE;
-		}
+	if (tick & TICK_CU)
+	{
+		TASK_RELEASE(TASK_CU);
+		TASK_RELEASE(TASK_COMMANDS);
+	}
 				
-	if (ONE_SECOND)
-		EnableDatalogging = TRUE;
+	if (--T0SecondTicks == 0)
+	{
+		T0SecondTicks = T0_FREQ;
+		TASK_RELEASE(TASK_DATALOG);
+	}
+}
+
+
+///////////////////////////////////////////////////////
+// Limit switch edge
+// Latches the limit and cancels the next control pulse
+// right away, rather than up to a controller update later.
+// Frame slots sample their limits in outputSlot() instead,
+// because the address lines (and thus the limit inputs)
+// change every slot.
+void interrupt isr_limit()
+{
+	uint8_t hit = 0;
+
+	if (!CpEnabled || FrameRunning) return;
+	if (StopOnLimit0 && LIMIT0_detected()) hit |= LIMIT0;
+	if (StopOnLimit1 && LIMIT1_detected()) hit |= LIMIT1;
+	if (!hit) return;
+	
+	if (!LimitLatched)
+		LimitLatency = T0Ticks - LastPulseTicks;
+	LimitLatched |= hit;
+	do_CO = doNothing;
 }
 
 
@@ -820,13 +2960,87 @@ void interrupt isr_timer0()
 void interrupt isr_timer1()
 {
 	SERVO_CP_low();
+	#ifdef _ISR_PROBES
+	{
+		int32_t late = t0_span(PulseStartTicks, PulseStartCount) - PulseCo;
+		probe_sample(PROBE_PULSE, late);
+		if (late > CO_MAX_RESERVE) mask_set(Error, ERROR_TIMING);
+	}
+	#endif
 }
 
 
 ///////////////////////////////////////////////////////
 // ADC read complete...
+//
+// Boxcar decimation: every block of ADC_BLOCK readings 
+// produces one Ain value, so each input is updated at a 
+// fixed rate, regardless of noise. Readings are taken here
+// as they complete, so none are lost while the main loop
+// is busy; check_adc() collects the finished blocks.
 void interrupt isr_adc()
 { 
+	static uint8_t schedIndex;
+	static uint8_t sampleCount;
+	static int sum, lo, hi;
+	uint8_t achIndex;
+
+	#ifdef _ISR_PROBES
+		if (++AdcProbeDivider == PROBE_ADC_PRESCALE - 1)
+		{
+			AdcEntryCount = t0_count();
+			AdcEntryTicks = T0Ticks;
+		}
+		else if (AdcProbeDivider == PROBE_ADC_PRESCALE)
+		{
+			AdcProbeDivider = 0;
+			probe_sample(PROBE_ADC, t0_span(AdcEntryTicks, AdcEntryCount));
+		}
+	#endif
+	
 	if (AdcdSettling)
+	{
 		--AdcdSettling;
+		return;
+	}
+	AdcIn = ADCD;
+	achIndex = AdcSchedule[schedIndex];
+	
+	if (ADCD_VALID(AdcIn))
+	{		
+		AdcIn = (AdcIn >> 3) - ADC_OFFSET;	// ? AdcIn = (AdcIn >> 3) + ADC_OFFSET;
+		++StabilityMeter;
+
+		if (sampleCount == 0)
+		{
+			sum = 0;
+			lo = hi = AdcIn;
+		}
+		sum += AdcIn;
+		if (AdcIn < lo) lo = AdcIn;
+		else if (AdcIn > hi) hi = AdcIn;
+
+		if (++sampleCount < ADC_BLOCK)
+			return;								// take another reading
+		
+		AdcIn = (sum + ADC_ROUND) >> ADC_DECIMATE_SHIFT;
+		AdcBlockNoise[achIndex] = hi - lo;
+	}	
+	else
+		AdcIn = ADC_OUTOFRANGE;
+	
+	sampleCount = 0;
+	AdcBlockAin[achIndex] = AdcIn;
+	AdcBlockReady |= 1 << achIndex;
+	TASK_RELEASE(TASK_ADC);
+	++AinBlocks[achIndex];
+
+	// uint8CounterReset() isn't reentrant
+	if (++schedIndex == ADC_SCHEDULE_LENGTH)
+		schedIndex = 0;
+	if (AdcSchedule[schedIndex] != achIndex)
+	{
+		ADC_SELECT(Ach[AdcSchedule[schedIndex]]);
+		adc_reset();
+	}
 }